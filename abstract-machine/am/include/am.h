@@ -25,7 +25,7 @@ typedef struct {
   enum {
     EVENT_NULL = 0,
     EVENT_YIELD, EVENT_SYSCALL, EVENT_PAGEFAULT, EVENT_ERROR,
-    EVENT_IRQ_TIMER, EVENT_IRQ_IODEV,
+    EVENT_IRQ_TIMER, EVENT_IRQ_IODEV, EVENT_IRQ_PMI,
   } event;
   uintptr_t cause, ref;
   const char *msg;
@@ -39,6 +39,12 @@ typedef struct {
   void *ptr;
 } AddrSpace;
 
+// An access to device register @reg with @buf, as in ioe_read()/ioe_write()
+typedef struct {
+  int reg;
+  void *buf;
+} IOEOp;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -52,6 +58,9 @@ void     halt        (int code) __attribute__((__noreturn__));
 bool     ioe_init    (void);
 void     ioe_read    (int reg, void *buf);
 void     ioe_write   (int reg, void *buf);
+// Accesses ops[0..@n) in order; backends may merge adjacent accesses, e.g.,
+// FBDRAWs of consecutive rows or BLKIOs of consecutive blocks
+void     ioe_batch   (const IOEOp *ops, int n);
 #include "amdev.h"
 
 // ---------- CTE: Interrupt Handling and Context Switching ----------
@@ -72,8 +81,80 @@ Context *ucontext    (AddrSpace *as, Area kstack, void *entry);
 bool     mpe_init    (void (*entry)());
 int      cpu_count   (void);
 int      cpu_current (void);
+// An area of CPU_DATA_SIZE bytes private to the running CPU, for the
+// kernel's own per-CPU variables
+#define CPU_DATA_SIZE 1024
+void    *cpu_data    (void);
 int      atomic_xchg (int *addr, int newval);
 
+// Read-modify-write operations are sequentially consistent and return the
+// value of *@addr before the update
+int      atomic_cmpxchg      (int *addr, int oldval, int newval);
+int      atomic_fetchadd     (int *addr, int val);
+int      atomic_fetchor      (int *addr, int mask);
+int      atomic_fetchand     (int *addr, int mask);
+int      atomic_load_acquire (int *addr);
+void     atomic_store_release(int *addr, int val);
+void     atomic_fence        (void);
+
+// ----------- Trap Latency: compiled in by -D__AM_TRAP_LATENCY__ -----------
+// Per-CPU, per-event log2 histograms of the stages of a trap, in cycles
+#define LAT_NR_BUCKET 32
+enum {
+  LAT_ENTRY,   // trap entry -> kernel handler called
+  LAT_HANDLER, // kernel handler called -> returned
+  LAT_EXIT,    // kernel handler returned -> iret
+  LAT_SWITCH,  // trap entry -> iret, for traps returning to another context
+  LAT_NR,
+};
+// @hist[k]: number of traps with @event on @cpu whose @stage took
+// [2^k, 2^(k+1)) cycles; false if not compiled in
+bool     lat_query   (int cpu, int event, int stage, uint32_t hist[LAT_NR_BUCKET]);
+void     lat_reset   (void);
+
+// --------------------- Tracing: Event Recording ---------------------
+// Ids of the events recorded by AM itself; kernels use ids >= TRACE_USER
+enum {
+  TRACE_NULL = 0,
+  TRACE_IRQ,      // trap entry:   event, cause (irq number), interrupted pc
+  TRACE_IRQ_RET,  // handled:      event, context to return to
+  TRACE_YIELD,    // yield():      caller pc
+  TRACE_SWITCH,   // resuming:     context, its address space, previous one
+  TRACE_USER = 256,
+};
+
+// A trace record, also the format of the dump (after a TraceHeader)
+typedef struct {
+  uint64_t ts;    // TSC on x86, nanoseconds on native
+  uint32_t id, cpu;
+  uint64_t arg[3];
+} TraceRecord;
+
+typedef struct {
+  char     magic[8]; // "AMTRACE"
+  uint32_t version, ncpu;
+  uint64_t ts_hz;    // timestamp ticks per second
+} TraceHeader;
+
+bool     trace_init  (Area buf);
+void     trace_event (int id, uintptr_t a0, uintptr_t a1, uintptr_t a2);
+void     trace_dump  (void);
+
+// ------------------- Profiling: Timer Sampling ---------------------
+// Every @period-th timer interrupt, count the interrupted pc and up to
+// @depth return addresses (by frame pointers) in a per-CPU histogram
+#define PROF_MAX_DEPTH 32
+bool     prof_init   (Area buf, int period, int depth);
+void     prof_dump   (void);
+
+// ------------------- Boot Timing: Phase Markers ---------------------
+// AM marks the end of each of its startup phases (also of ioe_init() and
+// mpe_init()) with a timestamp; kernels may mark their own. The summary is
+// printed before main() when AM is built with -D__AM_BOOT_TIMING__.
+#define BOOT_MAX_MARK 16
+void     boot_mark   (const char *phase);
+void     boot_report (void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -31,6 +31,9 @@ AM_DEVREG(21, NET_CONFIG,   RD, bool present);
 AM_DEVREG(22, NET_STATUS,   RD, int rx_len, tx_len);
 AM_DEVREG(23, NET_TX,       WR, Area buf);
 AM_DEVREG(24, NET_RX,       WR, Area buf);
+AM_DEVREG(25, PMU_CONFIG,   RD, bool present; int nr_counters, width);
+AM_DEVREG(26, PMU_CTRL,     WR, int counter, event; uint64_t period);
+AM_DEVREG(27, PMU_READ,     RD, uint64_t count[4]);
 
 // Input
 
@@ -49,6 +52,15 @@ enum {
   AM_KEYS(AM_KEY_NAMES)
 };
 
+// PMU: the events a counter can be programmed with by AM_PMU_CTRL. With a
+// nonzero period, the counter raises EVENT_IRQ_PMI every @period events.
+// AM_PMU_READ reads the first (at most) 4 counters of the current CPU.
+
+enum {
+  AM_PMU_NONE = 0, // disable the counter
+  AM_PMU_CYCLES, AM_PMU_INSTRUCTIONS, AM_PMU_LLC_MISSES, AM_PMU_BRANCH_MISSES,
+};
+
 // GPU
 
 #define AM_GPU_TEXTURE  1
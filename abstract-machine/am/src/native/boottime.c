@@ -0,0 +1,44 @@
+#include <time.h>
+#include "platform.h"
+
+// Boot-phase marks in nanoseconds of CLOCK_MONOTONIC, counted from the
+// entry of init_platform(), the earliest point where AM runs
+
+static struct {
+  const char *phase;
+  uint64_t ns;
+} marks[BOOT_MAX_MARK];
+static int nr_mark = 0;
+static uint64_t origin;
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void __am_boot_init() {
+  origin = now_ns();
+}
+
+void boot_mark(const char *phase) {
+  if (nr_mark < BOOT_MAX_MARK) {
+    marks[nr_mark].phase = phase;
+    marks[nr_mark].ns    = now_ns() - origin;
+    nr_mark++;
+  }
+}
+
+static void put_phase(const char *phase, uint64_t ns) {
+  printf("  %-16s%8d.%d us\n", phase, (int)(ns / 1000), (int)(ns / 100 % 10));
+}
+
+void boot_report() {
+  printf("AM boot phases:\n");
+  uint64_t last = 0;
+  for (int i = 0; i < nr_mark; i++) {
+    put_phase(marks[i].phase, marks[i].ns - last);
+    last = marks[i].ns;
+  }
+  put_phase("total", last);
+}
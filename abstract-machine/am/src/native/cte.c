@@ -1,8 +1,12 @@
-#include <sys/time.h>
+#include <sys/syscall.h>
 #include <string.h>
+#include <time.h>
 #include "platform.h"
 
-#define TIMER_HZ 100
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
 #define SYSCALL_INSTR_LEN 7
 
 static Context* (*user_handler)(Event, Context*) = NULL;
@@ -15,6 +19,39 @@ void __am_pmem_unprotect();
 
 void __am_panic_on_return() { panic("should not reach here\n"); }
 
+#ifdef __AM_TRAP_LATENCY__
+#define NR_EVENT (EVENT_IRQ_PMI + 1)
+
+// Shared by all CPUs in both MPE modes; only the owning CPU writes its
+// histograms
+static uint32_t lat_hist[MAX_CPU][NR_EVENT][LAT_NR][LAT_NR_BUCKET];
+
+static inline uint64_t rdtsc() { return __builtin_ia32_rdtsc(); }
+
+static void lat_record(int event, int stage, uint64_t cycles) {
+  int k = cycles ? 63 - __builtin_clzll(cycles) : 0;
+  if (k >= LAT_NR_BUCKET) k = LAT_NR_BUCKET - 1;
+  lat_hist[thiscpu->cpuid][event][stage][k]++;
+}
+#endif
+
+bool lat_query(int cpu, int event, int stage, uint32_t hist[LAT_NR_BUCKET]) {
+#ifdef __AM_TRAP_LATENCY__
+  if (cpu < 0 || cpu >= cpu_count() || event < 0 || event >= NR_EVENT ||
+      stage < 0 || stage >= LAT_NR) return false;
+  memcpy(hist, lat_hist[cpu][event][stage], sizeof(lat_hist[cpu][event][stage]));
+  return true;
+#else
+  return false;
+#endif
+}
+
+void lat_reset() {
+#ifdef __AM_TRAP_LATENCY__
+  memset(lat_hist, 0, sizeof(lat_hist));
+#endif
+}
+
 static void irq_handle(Context *c) {
   c->vm_head = thiscpu->vm_head;
   c->ksp = thiscpu->ksp;
@@ -25,8 +62,26 @@ static void irq_handle(Context *c) {
         thiscpu->ev.msg, rip, thiscpu->ev.ref, thiscpu->ev.cause);
     assert(0);
   }
+  greg_t *regs = c->uc.uc_mcontext.gregs;
+  trace_event(TRACE_IRQ, thiscpu->ev.event, thiscpu->ev.cause, regs[REG_RIP]);
+  if (thiscpu->ev.event == EVENT_IRQ_TIMER) {
+    __am_prof_sample(regs[REG_RIP], regs[REG_RBP], regs[REG_RSP],
+                     __am_in_userspace((void *)regs[REG_RIP]));
+  }
+#ifdef __AM_TRAP_LATENCY__
+  Context *saved_ctx = c;
+  uint64_t t_call = rdtsc();
+  lat_record(thiscpu->ev.event, LAT_ENTRY, t_call - thiscpu->lat_entry);
+#endif
   c = user_handler(thiscpu->ev, c);
   assert(c != NULL);
+#ifdef __AM_TRAP_LATENCY__
+  thiscpu->lat_ret = rdtsc();
+  thiscpu->lat_event = thiscpu->ev.event;
+  thiscpu->lat_switch = (c != saved_ctx);
+  lat_record(thiscpu->ev.event, LAT_HANDLER, thiscpu->lat_ret - t_call);
+#endif
+  trace_event(TRACE_IRQ_RET, thiscpu->ev.event, (uintptr_t)c, 0);
 
   __am_switch(c);
 
@@ -40,10 +95,9 @@ static void setup_stack(uintptr_t event, ucontext_t *uc) {
   void *rip = (void *)uc->uc_mcontext.gregs[REG_RIP];
   extern uint8_t _start, _etext;
   int trap_from_user = __am_in_userspace(rip);
-  int signal_safe = IN_RANGE(rip, RANGE(&_start, &_etext)) || trap_from_user ||
-    // Hack here: "+13" points to the instruction after syscall. This is the
-    // instruction which will trigger the pending signal if interrupt is enabled.
-    (rip == (void *)&sigprocmask + 13);
+  // Note that iset() issues the rt_sigprocmask syscall itself, so the pending
+  // signal unblocked by iset(1) is always delivered inside [_start, _etext).
+  int signal_safe = IN_RANGE(rip, RANGE(&_start, &_etext)) || trap_from_user;
 
   if (((event == EVENT_IRQ_IODEV) || (event == EVENT_IRQ_TIMER)) && !signal_safe) {
     // Shared libraries contain code which are not reenterable.
@@ -87,9 +141,24 @@ static void iret(ucontext_t *uc) {
   *uc = c->uc;
   thiscpu->ksp = c->ksp;
   if (__am_in_userspace((void *)uc->uc_mcontext.gregs[REG_RIP])) __am_pmem_protect();
+#ifdef __AM_TRAP_LATENCY__
+  // thiscpu->ev has been reset by sig_handler() for this SIGSEGV
+  uint64_t t_iret = rdtsc();
+  lat_record(thiscpu->lat_event, LAT_EXIT, t_iret - thiscpu->lat_ret);
+  if (thiscpu->lat_switch) {
+    lat_record(thiscpu->lat_event, LAT_SWITCH, t_iret - thiscpu->lat_entry);
+  }
+#endif
 }
 
 static void sig_handler(int sig, siginfo_t *info, void *ucontext) {
+  // Asynchronous signals may land on helper threads (e.g., created by SDL),
+  // which are not CPUs. Pretend to miss the interrupt, as setup_stack() does.
+  if (thiscpu == NULL && (sig == SIGUSR1 || sig == SIGVTALRM)) return;
+#ifdef __AM_TRAP_LATENCY__
+  uint64_t t_entry = rdtsc();
+#endif
+
   thiscpu->ev = (Event) {0};
   thiscpu->ev.event = EVENT_ERROR;
   switch (sig) {
@@ -122,6 +191,9 @@ static void sig_handler(int sig, siginfo_t *info, void *ucontext) {
     thiscpu->ev.cause = (uintptr_t)info->si_code;
     thiscpu->ev.msg = strsignal(sig);
   }
+#ifdef __AM_TRAP_LATENCY__
+  thiscpu->lat_entry = t_entry;
+#endif
   setup_stack(thiscpu->ev.event, ucontext);
 }
 
@@ -143,15 +215,27 @@ static void install_signal_handler() {
   assert(ret == 0);
 }
 
-// setitimer() are inherited across fork(), should be called again from children
+// Each CPU has its own timer, which fires on the wall clock (like the LAPIC
+// timer) and is delivered to the thread of that CPU only. POSIX timers are
+// not inherited across fork(), so this is called again from every CPU.
 void __am_init_timer_irq() {
   iset(0);
 
-  struct itimerval it = {};
-  it.it_value.tv_sec = 0;
-  it.it_value.tv_usec = 1000000 / TIMER_HZ;
-  it.it_interval = it.it_value;
-  int ret = setitimer(ITIMER_VIRTUAL, &it, NULL);
+  struct sigevent sev = {};
+  sev.sigev_notify = SIGEV_THREAD_ID;
+  sev.sigev_signo = SIGVTALRM;
+  sev.sigev_notify_thread_id = syscall(SYS_gettid);
+  timer_t timer;
+  int ret = timer_create(CLOCK_MONOTONIC, &sev, &timer);
+  assert(ret == 0);
+
+  extern int __am_timer_hz;
+  long period = 1000000000L / __am_timer_hz;
+  struct itimerspec its = {};
+  its.it_value.tv_sec = period / 1000000000L;
+  its.it_value.tv_nsec = period % 1000000000L;
+  its.it_interval = its.it_value;
+  ret = timer_settime(timer, 0, &its, NULL);
   assert(ret == 0);
 }
 
@@ -181,19 +265,30 @@ Context* kcontext(Area kstack, void (*entry)(void *), void *arg) {
 }
 
 void yield() {
+  trace_event(TRACE_YIELD, (uintptr_t)__builtin_return_address(0), 0, 0);
   raise(SIGUSR2);
 }
 
+// The signal mask is per-thread, i.e., per-CPU in both MPE modes.
+// This is what pthread_sigmask() does, but without calling into libc.
+static long intr_sigmask(int how, const sigset_t *set, sigset_t *oldset) {
+  long ret;
+  register long sigsetsize asm ("r10") = 8; // size of the kernel's sigset_t
+  asm volatile ("syscall" : "=a"(ret)
+      : "a"(SYS_rt_sigprocmask), "D"(how), "S"(set), "d"(oldset), "r"(sigsetsize)
+      : "rcx", "r11", "memory");
+  return ret;
+}
+
 bool ienabled() {
   sigset_t set;
-  int ret = sigprocmask(0, NULL, &set);
+  int ret = intr_sigmask(0, NULL, &set);
   assert(ret == 0);
   return __am_is_sigmask_sti(&set);
 }
 
 void iset(bool enable) {
   extern sigset_t __am_intr_sigmask;
-  // NOTE: sigprocmask does not supported in multithreading
-  int ret = sigprocmask(enable ? SIG_UNBLOCK : SIG_BLOCK, &__am_intr_sigmask, NULL);
+  int ret = intr_sigmask(enable ? SIG_UNBLOCK : SIG_BLOCK, &__am_intr_sigmask, NULL);
   assert(ret == 0);
 }
@@ -26,26 +26,48 @@ void __am_disk_status(AM_DISK_STATUS_T *stat);
 void __am_disk_blkio(AM_DISK_BLKIO_T *io);
 static void __am_uart_config(AM_UART_CONFIG_T *cfg)   { cfg->present = false; }
 static void __am_net_config (AM_NET_CONFIG_T *cfg)    { cfg->present = false; }
+static void __am_pmu_config (AM_PMU_CONFIG_T *cfg)    { cfg->present = false; }
+
+// Devices are initialized on the first access to one of their registers,
+// so that, e.g., reading the uptime does not create a window. Registers
+// with constant contents need no device.
+enum { DEV_NONE, DEV_TIMER, DEV_GPU, DEV_INPUT, DEV_AUDIO, DEV_DISK, NR_DEV };
+
+static const struct {
+  void (*init)();
+  int dep; // initialized before
+} devs[NR_DEV] = {
+  [DEV_TIMER] = { __am_timer_init, DEV_NONE },
+  [DEV_GPU  ] = { __am_gpu_init,   DEV_NONE },
+  [DEV_INPUT] = { __am_input_init, DEV_GPU  }, // key events come from the window
+  [DEV_AUDIO] = { __am_audio_init, DEV_NONE },
+  [DEV_DISK ] = { __am_disk_init,  DEV_NONE },
+};
+static int dev_ready[NR_DEV];
 
 typedef void (*handler_t)(void *buf);
-static void *lut[128] = {
-  [AM_TIMER_CONFIG] = __am_timer_config,
-  [AM_TIMER_RTC   ] = __am_timer_rtc,
-  [AM_TIMER_UPTIME] = __am_timer_uptime,
-  [AM_INPUT_CONFIG] = __am_input_config,
-  [AM_INPUT_KEYBRD] = __am_input_keybrd,
-  [AM_GPU_CONFIG  ] = __am_gpu_config,
-  [AM_GPU_FBDRAW  ] = __am_gpu_fbdraw,
-  [AM_GPU_STATUS  ] = __am_gpu_status,
-  [AM_UART_CONFIG ] = __am_uart_config,
-  [AM_AUDIO_CONFIG] = __am_audio_config,
-  [AM_AUDIO_CTRL  ] = __am_audio_ctrl,
-  [AM_AUDIO_STATUS] = __am_audio_status,
-  [AM_AUDIO_PLAY  ] = __am_audio_play,
-  [AM_DISK_CONFIG ] = __am_disk_config,
-  [AM_DISK_STATUS ] = __am_disk_status,
-  [AM_DISK_BLKIO  ] = __am_disk_blkio,
-  [AM_NET_CONFIG  ] = __am_net_config,
+static const struct {
+  void *handler;
+  int dev;
+} lut[128] = {
+  [AM_TIMER_CONFIG] = { __am_timer_config, DEV_NONE  },
+  [AM_TIMER_RTC   ] = { __am_timer_rtc,    DEV_TIMER },
+  [AM_TIMER_UPTIME] = { __am_timer_uptime, DEV_TIMER },
+  [AM_INPUT_CONFIG] = { __am_input_config, DEV_NONE  },
+  [AM_INPUT_KEYBRD] = { __am_input_keybrd, DEV_INPUT },
+  [AM_GPU_CONFIG  ] = { __am_gpu_config,   DEV_NONE  },
+  [AM_GPU_FBDRAW  ] = { __am_gpu_fbdraw,   DEV_GPU   },
+  [AM_GPU_STATUS  ] = { __am_gpu_status,   DEV_GPU   },
+  [AM_UART_CONFIG ] = { __am_uart_config,  DEV_NONE  },
+  [AM_AUDIO_CONFIG] = { __am_audio_config, DEV_AUDIO },
+  [AM_AUDIO_CTRL  ] = { __am_audio_ctrl,   DEV_AUDIO },
+  [AM_AUDIO_STATUS] = { __am_audio_status, DEV_AUDIO },
+  [AM_AUDIO_PLAY  ] = { __am_audio_play,   DEV_AUDIO },
+  [AM_DISK_CONFIG ] = { __am_disk_config,  DEV_DISK  },
+  [AM_DISK_STATUS ] = { __am_disk_status,  DEV_DISK  },
+  [AM_DISK_BLKIO  ] = { __am_disk_blkio,   DEV_DISK  },
+  [AM_NET_CONFIG  ] = { __am_net_config,   DEV_NONE  },
+  [AM_PMU_CONFIG  ] = { __am_pmu_config,   DEV_NONE  },
 };
 
 bool ioe_init() {
@@ -57,23 +79,89 @@ bool ioe_init() {
 
 static void fail(void *buf) { panic("access nonexist register"); }
 
+// CPUs may race for the first access in both MPE modes. Interrupts are
+// disabled while holding the lock, as the handler may access devices, too.
+// The boot phase "ioe_init" ends when the first device is ready, be it on
+// its first access or in __am_ioe_init().
+static void dev_init(int dev) {
+  static int lock = 0;
+  static bool marked = false;
+  if (dev == DEV_NONE || atomic_load_acquire(&dev_ready[dev])) return;
+  dev_init(devs[dev].dep);
+  bool intr = ienabled();
+  iset(false);
+  while (atomic_xchg(&lock, 1)) ;
+  if (!dev_ready[dev]) {
+    devs[dev].init();
+    atomic_store_release(&dev_ready[dev], 1);
+    if (!marked) {
+      marked = true;
+      boot_mark("ioe_init");
+    }
+  }
+  atomic_store_release(&lock, 0);
+  iset(intr);
+}
+
+// Initialize all devices at once, e.g., before other CPUs are started
+// in mpe_init(), since SDL threads and the files opened are per-process
 void __am_ioe_init() {
-  for (int i = 0; i < LENGTH(lut); i++)
-    if (!lut[i]) lut[i] = fail;
-  __am_timer_init();
-  __am_gpu_init();
-  __am_input_init();
-  __am_audio_init();
-  __am_disk_init();
+  for (int dev = DEV_NONE + 1; dev < NR_DEV; dev++) {
+    dev_init(dev);
+  }
   ioe_init_done = true;
 }
 
 static void do_io(int reg, void *buf) {
-  if (!ioe_init_done) {
-    __am_ioe_init();
-  }
-  ((handler_t)lut[reg])(buf);
+  dev_init(lut[reg].dev);
+  ((handler_t)(lut[reg].handler ? lut[reg].handler : fail))(buf);
 }
 
 void ioe_read (int reg, void *buf) { do_io(reg, buf); }
 void ioe_write(int reg, void *buf) { do_io(reg, buf); }
+
+#define BLKSZ 512 // as in ioe/disk.c
+
+// Merges the access to @reg with @buf into @cur when it continues @cur:
+// an FBDRAW of the rows right below from the rest of the same pixels, or
+// a BLKIO of the next blocks from/to the rest of the same buffer
+static bool coalesce(int reg, void *cur, const void *buf) {
+  switch (reg) {
+    case AM_GPU_FBDRAW: {
+      AM_GPU_FBDRAW_T *a = cur;
+      const AM_GPU_FBDRAW_T *b = buf;
+      if (b->x != a->x || b->w != a->w || b->y != a->y + a->h ||
+          b->pixels != (uint32_t *)a->pixels + a->w * a->h) return false;
+      a->h += b->h;
+      a->sync |= b->sync;
+      return true;
+    }
+    case AM_DISK_BLKIO: {
+      AM_DISK_BLKIO_T *a = cur;
+      const AM_DISK_BLKIO_T *b = buf;
+      if (b->write != a->write || b->blkno != a->blkno + a->blkcnt ||
+          b->buf != (uint8_t *)a->buf + a->blkcnt * BLKSZ) return false;
+      a->blkcnt += b->blkcnt;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ioe_batch(const IOEOp *ops, int n) {
+  for (int i = 0; i < n; ) {
+    int reg = ops[i].reg;
+    void *buf = ops[i++].buf;
+    union {
+      AM_GPU_FBDRAW_T fbdraw;
+      AM_DISK_BLKIO_T blkio;
+    } cur;
+    if (reg == AM_GPU_FBDRAW || reg == AM_DISK_BLKIO) {
+      if (reg == AM_GPU_FBDRAW) cur.fbdraw = *(AM_GPU_FBDRAW_T *)buf;
+      else                      cur.blkio  = *(AM_DISK_BLKIO_T *)buf;
+      while (i < n && ops[i].reg == reg && coalesce(reg, &cur, ops[i].buf)) i++;
+      buf = &cur;
+    }
+    do_io(reg, buf);
+  }
+}
@@ -1,41 +1,208 @@
-#include <am.h>
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <am.h> // after the system headers, since arch/native.h undefines __USE_GNU
+
+int __am_mpe_thread_mode();
 
 #define BLKSZ 512
 
+// I/O engines, selected by the environment variable "diskio"
+enum {
+  DISKIO_PREAD,  // pread()/pwrite() through the page cache (default)
+  DISKIO_DIRECT, // pread()/pwrite() with O_DIRECT
+  DISKIO_MMAP,   // memcpy() from/to a shared mapping of the whole image
+  DISKIO_ASYNC,  // pread()/pwrite() by worker threads; poll AM_DISK_STATUS
+                 // (the workers live in one process, so smp > 1 needs mpe=thread)
+};
+
+#define NR_WORKER 4
+#define QUEUE_LEN 64
+
 static int disk_size = 0;
-static FILE *fp = NULL;
+static int fd = -1, mode = DISKIO_PREAD;
+static off_t file_size = 0;
+static uint8_t *image = NULL;
+static size_t dio_align = 4096; // of O_DIRECT buffers, see __am_disk_init()
+
+static void disk_rw(bool write, void *buf, off_t off, size_t len) {
+  if (mode == DISKIO_MMAP && off < file_size) {
+    size_t n = (off + len <= file_size ? len : file_size - off);
+    if (write) memcpy(image + off, buf, n);
+    else memcpy(buf, image + off, n);
+    buf += n; off += n; len -= n;
+  }
+
+  void *bounce = NULL;
+  if (mode == DISKIO_DIRECT && ((uintptr_t)buf % dio_align != 0)) {
+    // O_DIRECT requires the user buffer to be aligned as well
+    int ret = posix_memalign(&bounce, dio_align, len);
+    assert(ret == 0);
+    if (write) memcpy(bounce, buf, len);
+  }
+
+  uint8_t *p = (bounce ? bounce : buf);
+  for (size_t done = 0; done < len; ) {
+    ssize_t n = (write ? pwrite(fd, p + done, len - done, off + done)
+                       : pread (fd, p + done, len - done, off + done));
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && errno == EINVAL && mode == DISKIO_DIRECT) {
+      // the device wants more alignment than assumed, e.g., of the length
+      // on a disk with 4 KiB sectors: go through the page cache from now on
+      fprintf(stderr, "disk: O_DIRECT rejected the access, using pread\n");
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+      mode = DISKIO_PREAD;
+      continue;
+    }
+    if (n <= 0) {
+      // the last block of an image whose size is not a multiple of
+      // BLKSZ is only partially backed by the file: read the rest as zeros.
+      // The device has no error status, so a failed access is reported
+      // here, and a failed read also gives zeros.
+      if (n < 0 || write) {
+        fprintf(stderr, "disk: %s of %zu bytes at offset %lld failed: %s\n",
+          write ? "write" : "read", len - done, (long long)(off + done),
+          n < 0 ? strerror(errno) : "no progress");
+      }
+      if (!write) memset(p + done, 0, len - done);
+      break;
+    }
+    done += n;
+  }
+
+  if (bounce) {
+    if (!write) memcpy(buf, bounce, len);
+    free(bounce);
+  }
+}
+
+// asynchronous submission: requests are queued and served by worker threads;
+// AM_DISK_STATUS.ready is false until every submitted request has completed
+
+static AM_DISK_BLKIO_T queue[QUEUE_LEN];
+static int q_head = 0, q_tail = 0, inflight = 0;
+static pthread_mutex_t q_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t q_nonempty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t q_nonfull = PTHREAD_COND_INITIALIZER;
+
+static void *disk_worker(void *arg) {
+  // workers are not CPUs, so they should never take interrupts
+  sigset_t set;
+  sigfillset(&set);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+  while (1) {
+    pthread_mutex_lock(&q_lock);
+    while (q_head == q_tail) pthread_cond_wait(&q_nonempty, &q_lock);
+    AM_DISK_BLKIO_T io = queue[q_head];
+    q_head = (q_head + 1) % QUEUE_LEN;
+    pthread_cond_signal(&q_nonfull);
+    pthread_mutex_unlock(&q_lock);
+
+    disk_rw(io.write, io.buf, (off_t)io.blkno * BLKSZ, (size_t)io.blkcnt * BLKSZ);
+
+    pthread_mutex_lock(&q_lock);
+    inflight --;
+    pthread_mutex_unlock(&q_lock);
+  }
+  return NULL;
+}
+
+// CPUs hold q_lock with interrupts disabled, as in dev_init() of ioe.c:
+// otherwise the timer handler may switch to a context that waits for
+// q_lock on the same thread, which then never gets it back
+static void disk_submit(AM_DISK_BLKIO_T *io) {
+  bool intr = ienabled();
+  iset(false);
+  pthread_mutex_lock(&q_lock);
+  while ((q_tail + 1) % QUEUE_LEN == q_head) pthread_cond_wait(&q_nonfull, &q_lock);
+  queue[q_tail] = *io;
+  q_tail = (q_tail + 1) % QUEUE_LEN;
+  inflight ++;
+  pthread_cond_signal(&q_nonempty);
+  pthread_mutex_unlock(&q_lock);
+  iset(intr);
+}
 
 void __am_disk_init() {
   const char *diskimg = getenv("diskimg");
+  const char *diskio = getenv("diskio");
+  if (diskio) {
+    if      (strcmp(diskio, "pread" ) == 0) mode = DISKIO_PREAD;
+    else if (strcmp(diskio, "direct") == 0) mode = DISKIO_DIRECT;
+    else if (strcmp(diskio, "mmap"  ) == 0) mode = DISKIO_MMAP;
+    else if (strcmp(diskio, "async" ) == 0) mode = DISKIO_ASYNC;
+    else assert(0);
+  }
+  // in mpe=fork, other CPUs are processes without the workers
+  if (mode == DISKIO_ASYNC && !__am_mpe_thread_mode() && cpu_count() > 1) {
+    fprintf(stderr, "disk: diskio=async requires mpe=thread when smp > 1\n");
+    halt(1);
+  }
+
   if (diskimg) {
-    fp = fopen(diskimg, "r+");
-    if (fp) {
-      fseek(fp, 0, SEEK_END);
-      disk_size = (ftell(fp) + 511) / 512;
-      rewind(fp);
+    fd = open(diskimg, O_RDWR | (mode == DISKIO_DIRECT ? O_DIRECT : 0));
+    if (fd < 0 && mode == DISKIO_DIRECT) {
+      // e.g., tmpfs does not support O_DIRECT
+      mode = DISKIO_PREAD;
+      fd = open(diskimg, O_RDWR);
+    }
+    if (fd >= 0) {
+      struct stat st;
+      int ret = fstat(fd, &st);
+      assert(ret == 0);
+      file_size = st.st_size;
+      disk_size = (file_size + BLKSZ - 1) / BLKSZ;
+      // the logical block size of the device is not known here: a page
+      // covers it on all common disks, and st_blksize where it is larger
+      if (st.st_blksize > dio_align) dio_align = st.st_blksize;
+
+      if (mode == DISKIO_MMAP && file_size > 0) {
+        image = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        assert(image != MAP_FAILED);
+      }
+      if (mode == DISKIO_ASYNC) {
+        for (int i = 0; i < NR_WORKER; i++) {
+          pthread_t thread;
+          ret = pthread_create(&thread, NULL, disk_worker, NULL);
+          assert(ret == 0);
+        }
+      }
     }
   }
 }
 
 void __am_disk_config(AM_DISK_CONFIG_T *cfg) {
-  cfg->present = (fp != NULL);
+  cfg->present = (fd >= 0);
   cfg->blksz = BLKSZ;
   cfg->blkcnt = disk_size;
 }
 
 void __am_disk_status(AM_DISK_STATUS_T *stat) {
-  stat->ready = 1;
+  if (mode == DISKIO_ASYNC) {
+    bool intr = ienabled();
+    iset(false);
+    pthread_mutex_lock(&q_lock);
+    stat->ready = (inflight == 0);
+    pthread_mutex_unlock(&q_lock);
+    iset(intr);
+  } else {
+    stat->ready = 1;
+  }
 }
 
 void __am_disk_blkio(AM_DISK_BLKIO_T *io) {
-  if (fp) {
-    fseek(fp, io->blkno * BLKSZ, SEEK_SET);
-    int ret;
-    if (io->write) ret = fwrite(io->buf, io->blkcnt * BLKSZ, 1, fp);
-    else ret = fread(io->buf, io->blkcnt * BLKSZ, 1, fp);
-    assert(ret == 1);
+  if (fd >= 0) {
+    if (mode == DISKIO_ASYNC) disk_submit(io);
+    else disk_rw(io->write, io->buf, (off_t)io->blkno * BLKSZ, (size_t)io->blkcnt * BLKSZ);
   }
 }
@@ -1,6 +1,11 @@
 #include <am.h>
 #include <SDL2/SDL.h>
 #include <fenv.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <klib.h>
 
 //#define MODE_800x600
 #ifdef MODE_800x600
@@ -20,6 +25,12 @@
 
 static SDL_Window *window = NULL;
 static SDL_Surface *surface = NULL;
+static uint32_t *fb = NULL; // in the headless mode
+
+bool __am_gpu_headless() {
+  const char *gpu = getenv("gpu");
+  return gpu && strcmp(gpu, "sdl") != 0;
+}
 
 static Uint32 texture_sync(Uint32 interval, void *param) {
   SDL_BlitScaled(surface, NULL, SDL_GetWindowSurface(window), NULL);
@@ -27,7 +38,31 @@ static Uint32 texture_sync(Uint32 interval, void *param) {
   return interval;
 }
 
+// Headless mode ("gpu=mem" or "gpu=FILE") draws into a framebuffer without
+// a window and the timer refreshing it, kept in shared memory (as CPUs may
+// be processes) or mapped from FILE as W * H raw 32-bit pixels
+static void *headless_fb() {
+  const char *gpu = getenv("gpu");
+  size_t size = W * H * sizeof(uint32_t);
+  int fd = -1, flags = MAP_SHARED | MAP_ANONYMOUS;
+  if (strcmp(gpu, "mem") != 0) {
+    fd = open(gpu, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    assert(fd >= 0);
+    int ret = ftruncate(fd, size);
+    assert(ret == 0);
+    flags = MAP_SHARED;
+  }
+  void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+  assert(mem != MAP_FAILED);
+  if (fd >= 0) close(fd);
+  return mem;
+}
+
 void __am_gpu_init() {
+  if (__am_gpu_headless()) {
+    fb = headless_fb();
+    return;
+  }
   SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER);
   window = SDL_CreateWindow("Native Application",
       SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
@@ -57,6 +92,16 @@ void __am_gpu_status(AM_GPU_STATUS_T *stat) {
 void __am_gpu_fbdraw(AM_GPU_FBDRAW_T *ctl) {
   int x = ctl->x, y = ctl->y, w = ctl->w, h = ctl->h;
   if (w == 0 || h == 0) return;
+  if (fb) {
+    for (int j = (y < 0 ? -y : 0); j < h && y + j < H; j++) {
+      int i0 = (x < 0 ? -x : 0), i1 = (x + w > W ? W - x : w);
+      if (i0 < i1) {
+        memcpy(&fb[(y + j) * W + x + i0], (uint32_t *)ctl->pixels + j * w + i0,
+               (i1 - i0) * sizeof(uint32_t));
+      }
+    }
+    return;
+  }
   feclearexcept(-1);
   SDL_Surface *s = SDL_CreateRGBSurfaceFrom(ctl->pixels, w, h, 32, w * sizeof(uint32_t),
       RMASK, GMASK, BMASK, AMASK);
@@ -3,6 +3,8 @@
 
 #define KEYDOWN_MASK 0x8000
 
+bool __am_gpu_headless();
+
 #define KEY_QUEUE_LEN 1024
 static int key_queue[KEY_QUEUE_LEN] = {};
 static int key_f = 0, key_r = 0;
@@ -41,7 +43,10 @@ static int event_thread(void *args) {
 
 void __am_input_init() {
   key_queue_lock = SDL_CreateMutex();
-  SDL_CreateThread(event_thread, "event thread", NULL);
+  // no window, no key events in the headless mode
+  if (!__am_gpu_headless()) {
+    SDL_CreateThread(event_thread, "event thread", NULL);
+  }
 }
 
 void __am_input_config(AM_INPUT_CONFIG_T *cfg) {
@@ -1,12 +1,44 @@
 #include <stdatomic.h>
+#include <pthread.h>
 #include "platform.h"
 
 int __am_mpe_init = 0;
 extern bool __am_has_ioe;
 void __am_ioe_init();
 
+static void (*user_entry)();
+
+static void *othercpu_thread(void *arg) {
+  __am_init_cpu((intptr_t)arg);
+  __am_init_timer_irq();
+  user_entry();
+  panic("MP entry should not return\n");
+}
+
+// Threads share everything, so there is no need to hold other CPUs back
+// until IOE is initialized: simply start them afterwards.
+static void mpe_init_thread() {
+  if (__am_has_ioe) {
+    __am_ioe_init();
+  }
+
+  for (int i = 1; i < cpu_count(); i++) {
+    pthread_t thread;
+    int ret = pthread_create(&thread, NULL, othercpu_thread, (void *)(intptr_t)i);
+    assert(ret == 0);
+  }
+}
+
 bool mpe_init(void (*entry)()) {
   __am_mpe_init = 1;
+  user_entry = entry;
+
+  if (__am_mpe_thread_mode()) {
+    mpe_init_thread();
+    boot_mark("mpe_init");
+    entry();
+    panic("MP entry should not return\n");
+  }
 
   int sync_pipe[2];
   assert(0 == pipe(sync_pipe));
@@ -32,7 +64,8 @@ bool mpe_init(void (*entry)()) {
     assert(write(sync_pipe[1], "+", 1) == 1);
   }
   close(sync_pipe[0]); close(sync_pipe[1]);
-  
+  boot_mark("mpe_init");
+
   entry();
   panic("MP entry should not return\n");
 }
@@ -46,6 +79,39 @@ int cpu_current() {
   return thiscpu->cpuid;
 }
 
+void *cpu_data() {
+  return thiscpu->data;
+}
+
 int atomic_xchg(int *addr, int newval) {
   return atomic_exchange((int *)addr, newval);
 }
+
+int atomic_cmpxchg(int *addr, int oldval, int newval) {
+  atomic_compare_exchange_strong((int *)addr, &oldval, newval);
+  return oldval;
+}
+
+int atomic_fetchadd(int *addr, int val) {
+  return atomic_fetch_add((int *)addr, val);
+}
+
+int atomic_fetchor(int *addr, int mask) {
+  return atomic_fetch_or((int *)addr, mask);
+}
+
+int atomic_fetchand(int *addr, int mask) {
+  return atomic_fetch_and((int *)addr, mask);
+}
+
+int atomic_load_acquire(int *addr) {
+  return atomic_load_explicit((int *)addr, memory_order_acquire);
+}
+
+void atomic_store_release(int *addr, int val) {
+  atomic_store_explicit((int *)addr, val, memory_order_release);
+}
+
+void atomic_fence() {
+  atomic_thread_fence(memory_order_seq_cst);
+}
@@ -7,7 +7,7 @@
 #include <stdio.h>
 #include "platform.h"
 
-#define MAX_CPU 16
+#define TIMER_HZ 100 // default frequency of timer interrupts
 #define TRAP_PAGE_START (void *)0x100000
 #define PMEM_START (void *)0x1000000  // for nanos-lite with vme disabled
 #define PMEM_SIZE (128 * 1024 * 1024) // 128MB
@@ -17,9 +17,11 @@ static ucontext_t uc_example = {};
 static int sys_pgsz;
 static void *(*memcpy_libc)(void *, const void *, size_t) = NULL;
 sigset_t __am_intr_sigmask = {};
-__am_cpu_t *__am_cpu_struct = NULL;
+__thread __am_cpu_t *__am_cpu_struct = NULL;
 int __am_ncpu = 0;
 int __am_pgsize;
+int __am_timer_hz;
+static int mpe_thread_mode = 0;
 
 static void save_context_handler(int sig, siginfo_t *info, void *ucontext) {
   memcpy_libc(&uc_example, ucontext, sizeof(uc_example));
@@ -56,10 +58,24 @@ static void setup_sigaltstack() {
   assert(ret == 0);
 }
 
+// allocate and install the private per-cpu structure of the calling CPU
+void __am_init_cpu(int cpuid) {
+  thiscpu = mmap(NULL, sizeof(*thiscpu), PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  assert(thiscpu != (void *)-1);
+  thiscpu->cpuid = cpuid;
+  thiscpu->vm_head = NULL;
+
+  // the alternative signal stack is per-thread and inherited across fork()
+  setup_sigaltstack();
+}
+
 int main(const char *args);
 
 static void init_platform() __attribute__((constructor));
 static void init_platform() {
+  __am_boot_init();
+
   // create memory object and set up mapping to simulate the physical memory
   pmem_fd = memfd_create("pmem", 0);
   assert(pmem_fd != -1);
@@ -68,13 +84,10 @@ static void init_platform() {
   pmem = mmap(PMEM_START, PMEM_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
       MAP_SHARED | MAP_FIXED, pmem_fd, 0);
   assert(pmem != (void *)-1);
+  boot_mark("pmem");
 
   // allocate private per-cpu structure
-  thiscpu = mmap(NULL, sizeof(*thiscpu), PROT_READ | PROT_WRITE,
-      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-  assert(thiscpu != (void *)-1);
-  thiscpu->cpuid = 0;
-  thiscpu->vm_head = NULL;
+  __am_init_cpu(0);
 
   // create trap page to receive syscall and yield by SIGSEGV
   sys_pgsz = sysconf(_SC_PAGESIZE);
@@ -85,6 +98,7 @@ static void init_platform() {
   // save the address of memcpy() in glibc, since it may be linked with klib
   memcpy_libc = dlsym(RTLD_NEXT, "memcpy");
   assert(memcpy_libc != NULL);
+  boot_mark("trap_page");
 
   // remap writable sections as MAP_SHARED
   Elf64_Phdr *phdr = (void *)getauxval(AT_PHDR);
@@ -131,6 +145,8 @@ static void init_platform() {
     }
   }
 
+  boot_mark("remap_sections");
+
   // set up the AM heap
   heap = RANGE(pmem, pmem + PMEM_SIZE);
 
@@ -142,9 +158,6 @@ static void init_platform() {
   ret2 = sigaddset(&__am_intr_sigmask, SIGUSR1);
   assert(ret2 == 0);
 
-  // setup alternative signal stack
-  setup_sigaltstack();
-
   // save the context template
   save_example_context();
   uc_example.uc_mcontext.fpregs = NULL; // clear the FPU context
@@ -152,12 +165,24 @@ static void init_platform() {
 
   // disable interrupts by default
   iset(0);
+  boot_mark("save_context");
 
   // set ncpu
   const char *smp = getenv("smp");
   __am_ncpu = smp ? atoi(smp) : 1;
   assert(0 < __am_ncpu && __am_ncpu <= MAX_CPU);
 
+  // set timer frequency
+  const char *hz = getenv("hz");
+  __am_timer_hz = hz ? atoi(hz) : TIMER_HZ;
+  assert(0 < __am_timer_hz && __am_timer_hz <= 1000000);
+
+  // set MPE mode: "fork" (default) simulates each CPU by a process sharing
+  // the data sections, "thread" by a thread sharing the whole address space
+  const char *mpe = getenv("mpe");
+  mpe_thread_mode = mpe && strcmp(mpe, "thread") == 0;
+  assert(!mpe || mpe_thread_mode || strcmp(mpe, "fork") == 0);
+
   // set pgsize
   const char *pgsize = getenv("pgsize");
   __am_pgsize = pgsize ? atoi(pgsize) : sys_pgsz;
@@ -167,16 +192,24 @@ static void init_platform() {
   setbuf(stdout, NULL);
 
   const char *args = getenv("mainargs");
+  boot_mark("config");
+#ifdef __AM_BOOT_TIMING__
+  boot_report();
+#endif
   halt(main(args ? args : "")); // call main here!
 }
 
 void __am_exit_platform(int code) {
   // let Linux clean up other resource
   extern int __am_mpe_init;
-  if (__am_mpe_init && cpu_count() > 1) kill(0, SIGKILL);
+  if (__am_mpe_init && cpu_count() > 1 && !mpe_thread_mode) kill(0, SIGKILL);
   exit(code);
 }
 
+int __am_mpe_thread_mode() {
+  return mpe_thread_mode;
+}
+
 void __am_pmem_map(void *va, void *pa, int prot) {
   // translate AM prot to mmap prot
   int mmap_prot = PROT_NONE;
@@ -13,6 +13,12 @@ int __am_is_sigmask_sti(sigset_t *s);
 void __am_init_timer_irq();
 void __am_pmem_map(void *va, void *pa, int prot);
 void __am_pmem_unmap(void *va);
+void __am_init_cpu(int cpuid);
+int __am_mpe_thread_mode();
+void __am_prof_sample(uintptr_t pc, uintptr_t fp, uintptr_t sp, bool user);
+void __am_boot_init();
+
+#define MAX_CPU 16
 
 // per-cpu structure
 typedef struct {
@@ -20,9 +26,17 @@ typedef struct {
   uintptr_t ksp;
   int cpuid;
   Event ev; // similar to cause register in mips/riscv
+#ifdef __AM_TRAP_LATENCY__
+  uint64_t lat_entry, lat_ret; // stamps of the trap being handled
+  int lat_event;
+  bool lat_switch;
+#endif
   uint8_t sigstack[SIGSTKSZ];
+  uint8_t data[CPU_DATA_SIZE];
 } __am_cpu_t;
-extern __am_cpu_t *__am_cpu_struct;
+// thread-local, so that it is private to each CPU in both the fork()-based
+// and the pthread-based MPE implementations
+extern __thread __am_cpu_t *__am_cpu_struct;
 #define thiscpu __am_cpu_struct
 
 #endif
@@ -0,0 +1,119 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/uio.h>
+#include "platform.h"
+
+// Per-CPU histograms of sampled call stacks, as in x86/qemu/prof.c. The
+// tables live in the buffer given by the kernel, which is shared by the
+// CPUs in both MPE modes.
+
+#define NR_PROBE    16
+#define STACK_LIMIT (1 << 16) // frame pointers farther than this from sp are bogus
+
+struct table {
+  uintptr_t *bucket; // count, pc, return addresses (0-terminated)
+  uint32_t mask, ticks, samples, lost;
+};
+
+static struct table tables[MAX_CPU];
+static int period, depth;
+static volatile bool enabled = false;
+
+bool prof_init(Area buf, int every, int max_depth) {
+  if (every < 1 || max_depth < 0 || max_depth > PROF_MAX_DEPTH) return false;
+  uintptr_t start = ROUNDUP(buf.start, sizeof(uintptr_t));
+  int words = 2 + max_depth;
+  uint32_t nr = ((uintptr_t)buf.end - start) / sizeof(uintptr_t) / words / cpu_count();
+  if (nr == 0) return false;
+  while (nr & (nr - 1)) nr &= nr - 1; // round down to a power of 2
+
+  memset((void *)start, 0, nr * words * cpu_count() * sizeof(uintptr_t));
+  for (int i = 0; i < cpu_count(); i++) {
+    tables[i] = (struct table) {
+      .bucket = (uintptr_t *)start + i * nr * words,
+      .mask   = nr - 1,
+    };
+  }
+  period = every;
+  depth = max_depth;
+  enabled = true;
+  return true;
+}
+
+static void record(struct table *t, const uintptr_t *key) {
+  int words = 2 + depth;
+  uint32_t h = 2166136261u;
+  for (int i = 0; i <= depth; i++) h = (h ^ key[i]) * 16777619u;
+
+  for (int probe = 0; probe < NR_PROBE; probe++) {
+    uintptr_t *b = t->bucket + ((h + probe) & t->mask) * words;
+    if (b[0] == 0) {
+      for (int i = 0; i <= depth; i++) b[1 + i] = key[i];
+      b[0] = 1;
+      return;
+    }
+    int i = 0;
+    while (i <= depth && b[1 + i] == key[i]) i++;
+    if (i > depth) { b[0]++; return; }
+  }
+  t->lost++;
+}
+
+// Unlike x86-qemu, memory near the stack is not necessarily mapped here
+// (e.g., above the top of the main thread's stack), so frames are read
+// by process_vm_readv(), which fails instead of raising SIGSEGV.
+static bool read_frame(uintptr_t fp, uintptr_t frame[2]) {
+  struct iovec local = { frame, 2 * sizeof(uintptr_t) };
+  struct iovec remote = { (void *)fp, 2 * sizeof(uintptr_t) };
+  return process_vm_readv(getpid(), &local, 1, &remote, 1, 0) == 2 * sizeof(uintptr_t);
+}
+
+void __am_prof_sample(uintptr_t pc, uintptr_t fp, uintptr_t sp, bool user) {
+  if (!enabled) return;
+  struct table *t = &tables[cpu_current()];
+  if (++t->ticks % period != 0) return;
+  t->samples++;
+
+  uintptr_t key[PROF_MAX_DEPTH + 1] = { pc };
+  // never follow the frames of the user address space
+  for (int n = 1; n <= depth && !user; n++) {
+    uintptr_t frame[2];
+    if (fp - sp >= STACK_LIMIT || fp % sizeof(uintptr_t) != 0 || !read_frame(fp, frame)) break;
+    if ((key[n] = frame[1]) == 0 || frame[0] <= fp) break;
+    fp = frame[0];
+  }
+  record(t, key);
+}
+
+// The histograms go to the file given by the environment variable "prof"
+// (default: prof.txt), to be symbolized by scripts/amprof.py.
+void prof_dump() {
+  if (!enabled) return;
+  enabled = false;
+
+  const char *path = getenv("prof");
+  FILE *fp = fopen(path ? path : "prof.txt", "w");
+  assert(fp != NULL);
+
+  extern char _start;
+  int words = 2 + depth;
+  fprintf(fp, "=== AMPROF BEGIN ===\nstart %p\n", &_start);
+  for (int i = 0; i < cpu_count(); i++) {
+    struct table *t = &tables[i];
+    fprintf(fp, "cpu %d samples %u lost %u\n", i, t->samples, t->lost);
+    for (uint32_t k = 0; k <= t->mask; k++) {
+      uintptr_t *b = t->bucket + k * words;
+      if (b[0] == 0) continue;
+      fprintf(fp, "%lu", b[0]);
+      for (int n = 0; n <= depth && b[1 + n] != 0; n++) {
+        fprintf(fp, " %#lx", b[1 + n]);
+      }
+      fprintf(fp, "\n");
+    }
+  }
+  fprintf(fp, "=== AMPROF END ===\n");
+  fclose(fp);
+
+  enabled = true;
+}
@@ -0,0 +1,87 @@
+#include <stdlib.h>
+#include <fcntl.h>
+#include <time.h>
+#include "platform.h"
+
+// Per-CPU rings of trace records, as in x86/qemu/trace.c. The rings live
+// in the data section, which is shared by the CPUs in both MPE modes, so
+// any CPU can dump all of them.
+
+struct ring {
+  TraceRecord *rec;
+  uint32_t head, mask;
+};
+
+static struct ring rings[MAX_CPU];
+static volatile bool enabled = false;
+
+bool trace_init(Area buf) {
+  uintptr_t start = ROUNDUP(buf.start, 8);
+  uint32_t nr = ((uintptr_t)buf.end - start) / sizeof(TraceRecord) / cpu_count();
+  if (nr == 0) return false;
+  while (nr & (nr - 1)) nr &= nr - 1; // round down to a power of 2
+
+  for (int i = 0; i < cpu_count(); i++) {
+    rings[i] = (struct ring) {
+      .rec  = (TraceRecord *)start + i * nr,
+      .head = 0,
+      .mask = nr - 1,
+    };
+  }
+  enabled = true;
+  return true;
+}
+
+void trace_event(int id, uintptr_t a0, uintptr_t a1, uintptr_t a2) {
+  if (!enabled) return;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  int cpu = cpu_current();
+  struct ring *r = &rings[cpu];
+  TraceRecord *rec = &r->rec[__atomic_fetch_add(&r->head, 1, __ATOMIC_RELAXED) & r->mask];
+  *rec = (TraceRecord) {
+    .ts  = ts.tv_sec * 1000000000ull + ts.tv_nsec,
+    .id  = id, .cpu = cpu,
+    .arg = { a0, a1, a2 },
+  };
+}
+
+static void write_all(int fd, const void *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    assert(n > 0);
+    buf += n; len -= n;
+  }
+}
+
+// The dump goes to the file given by the environment variable "trace"
+// (default: trace.bin), to be decoded by scripts/amtrace.py.
+void trace_dump() {
+  if (!enabled) return;
+  enabled = false;
+
+  const char *path = getenv("trace");
+  int fd = open(path ? path : "trace.bin", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  assert(fd >= 0);
+
+  TraceHeader hdr = {
+    .magic   = "AMTRACE",
+    .version = 1,
+    .ncpu    = cpu_count(),
+    .ts_hz   = 1000000000,
+  };
+  write_all(fd, &hdr, sizeof(hdr));
+  for (int i = 0; i < cpu_count(); i++) {
+    struct ring *r = &rings[i];
+    uint32_t head = r->head, n = r->mask + 1;
+    // the part of the ring in use is at most two contiguous pieces
+    uint32_t first = (head > n ? head - n : 0);
+    uint32_t from = first & r->mask, len = head - first;
+    uint32_t len1 = (from + len > n ? n - from : len);
+    write_all(fd, &r->rec[from], len1 * sizeof(TraceRecord));
+    write_all(fd, &r->rec[0], (len - len1) * sizeof(TraceRecord));
+  }
+  close(fd);
+
+  enabled = true;
+}
@@ -28,6 +28,9 @@ static void* (*pgalloc)(int) = NULL;
 static void (*pgfree)(void *) = NULL;
 
 bool vme_init(void* (*pgalloc_f)(int), void (*pgfree_f)(void*)) {
+  // user mappings are installed with mmap(), which is per-process
+  panic_on(__am_mpe_thread_mode() && cpu_count() > 1,
+      "VME requires mpe=fork when smp > 1");
   pgalloc = pgalloc_f;
   pgfree = pgfree_f;
   vme_enable = 1;
@@ -52,6 +55,8 @@ void unprotect(AddrSpace *as) {
 }
 
 void __am_switch(Context *c) {
+  trace_event(TRACE_SWITCH, (uintptr_t)c, (uintptr_t)c->vm_head,
+              (uintptr_t)thiscpu->vm_head);
   if (!vme_enable) return;
 
   VMHead *head = c->vm_head;
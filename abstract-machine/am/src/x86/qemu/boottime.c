@@ -0,0 +1,61 @@
+#include "x86-qemu.h"
+
+// Boot-phase marks in TSC cycles. The TSC counts from the reset of the
+// bootstrap CPU, so the first phase is the firmware up to the boot loader,
+// which stamps its entry in the boot record.
+
+static struct {
+  const char *phase;
+  uint64_t tsc;
+} marks[BOOT_MAX_MARK];
+static int nr_mark = 0;
+
+static void mark_at(const char *phase, uint64_t tsc) {
+  if (nr_mark < BOOT_MAX_MARK) {
+    marks[nr_mark].phase = phase;
+    marks[nr_mark].tsc   = tsc;
+    nr_mark++;
+  }
+}
+
+void __am_boot_init() {
+  mark_at("firmware", boot_record()->tsc);
+  mark_at("bootloader", rdtsc());
+}
+
+void boot_mark(const char *phase) {
+  mark_at(phase, rdtsc());
+}
+
+static void put_u64(uint64_t x, int width) {
+  char buf[24], *p = buf + sizeof(buf);
+  *--p = '\0';
+  do { *--p = '0' + x % 10; x /= 10; } while (x);
+  for (int n = buf + sizeof(buf) - 1 - p; n < width; n++) putch(' ');
+  putstr(p);
+}
+
+static void put_phase(const char *phase, uint64_t cycles) {
+  extern uint32_t __am_freq_mhz;
+  extern bool __am_freq_estimated;
+  int n = 0;
+  putstr("  ");
+  for (; *phase; phase++, n++) putch(*phase);
+  for (; n < 16; n++) putch(' ');
+  put_u64(cycles, 14); putstr(" cycles");
+  if (__am_freq_estimated) {
+    put_u64(cycles / __am_freq_mhz, 10); putstr(" us");
+  }
+  putch('\n');
+}
+
+// The TSC frequency is known only after ioe_init()
+void boot_report() {
+  putstr("AM boot phases:\n");
+  uint64_t last = 0;
+  for (int i = 0; i < nr_mark; i++) {
+    put_phase(marks[i].phase, marks[i].tsc - last);
+    last = marks[i].tsc;
+  }
+  put_phase("total", last);
+}
@@ -16,8 +16,50 @@ IRQS(IRQHANDLE_DECL)
 void __am_irqall();
 void __am_kcontext_start();
 
+#ifdef __AM_TRAP_LATENCY__
+#define NR_EVENT (EVENT_IRQ_PMI + 1)
+
+// Only the owning CPU writes its histograms
+static uint32_t lat_hist[MAX_CPU][NR_EVENT][LAT_NR][LAT_NR_BUCKET];
+
+static void lat_record(int event, int stage, uint64_t cycles) {
+  uint32_t lo = cycles;
+  int k = (cycles >> 32) ? LAT_NR_BUCKET - 1 : (lo ? 31 - __builtin_clz(lo) : 0);
+  lat_hist[cpu_current()][event][stage][k]++;
+}
+#endif
+
+bool lat_query(int cpu, int event, int stage, uint32_t hist[LAT_NR_BUCKET]) {
+#ifdef __AM_TRAP_LATENCY__
+  if (cpu < 0 || cpu >= __am_ncpu || event < 0 || event >= NR_EVENT ||
+      stage < 0 || stage >= LAT_NR) return false;
+  for (int k = 0; k < LAT_NR_BUCKET; k++) {
+    hist[k] = lat_hist[cpu][event][stage][k];
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+void lat_reset() {
+#ifdef __AM_TRAP_LATENCY__
+  for (uint32_t *p = (uint32_t *)lat_hist; p < (uint32_t *)(lat_hist + MAX_CPU); p++) {
+    *p = 0;
+  }
+#endif
+}
+
 void __am_irq_handle(struct trap_frame *tf) {
   Context *saved_ctx = &tf->saved_context;
+#ifdef __AM_TRAP_LATENCY__
+  // stamped by the trap entry, see trap{32,64}.S
+#if __x86_64__
+  uint64_t t_entry = saved_ctx->rip;
+#else
+  uint64_t t_entry = saved_ctx->eip | ((uint64_t)saved_ctx->cs << 32);
+#endif
+#endif
   Event ev = {
     .event = EVENT_NULL,
     .cause = 0, .ref = 0,
@@ -53,9 +95,14 @@ void __am_irq_handle(struct trap_frame *tf) {
     case IRQ 0: MSG("timer interrupt (lapic)")
       ev.event = EVENT_IRQ_TIMER; break;
     case IRQ 1: MSG("I/O device IRQ1 (keyboard)")
+      __am_kbd_intr();
       ev.event = EVENT_IRQ_IODEV; break;
     case IRQ 4: MSG("I/O device IRQ4 (COM1)")
       ev.event = EVENT_IRQ_IODEV; break;
+    case IRQ 18: MSG("performance counter overflow (lapic), @cause: counters")
+      ev.event = EVENT_IRQ_PMI;
+      ev.cause = __am_pmu_overflow();
+      break;
     case EX_SYSCALL: MSG("int $0x80 system call")
       ev.event = EVENT_SYSCALL; break;
     case EX_YIELD: MSG("int $0x81 yield")
@@ -89,8 +136,30 @@ void __am_irq_handle(struct trap_frame *tf) {
       break;
   }
 
+#if __x86_64__
+  trace_event(TRACE_IRQ, ev.event, tf->irq, tf->rip);
+  if (tf->irq == IRQ 0) {
+    __am_prof_sample(tf->rip, saved_ctx->rbp, tf->rsp, tf->cs & DPL_USER);
+  }
+#else
+  trace_event(TRACE_IRQ, ev.event, tf->irq, tf->eip);
+  if (tf->irq == IRQ 0) {
+    __am_prof_sample(tf->eip, saved_ctx->ebp, saved_ctx->esp, tf->cs & DPL_USER);
+  }
+#endif
+
+#ifdef __AM_TRAP_LATENCY__
+  uint64_t t_call = rdtsc();
+#endif
   Context *ret_ctx = user_handler(ev, saved_ctx);
   panic_on(!ret_ctx, "returning to NULL context");
+#ifdef __AM_TRAP_LATENCY__
+  uint64_t t_ret = rdtsc();
+#endif
+
+  trace_event(TRACE_SWITCH, (uintptr_t)ret_ctx, (uintptr_t)ret_ctx->cr3,
+              (uintptr_t)saved_ctx->cr3);
+  trace_event(TRACE_IRQ_RET, ev.event, (uintptr_t)ret_ctx, 0);
 
   if (ret_ctx->cr3) {
     set_cr3(ret_ctx->cr3);
@@ -102,6 +171,16 @@ void __am_irq_handle(struct trap_frame *tf) {
 #endif
   }
 
+#ifdef __AM_TRAP_LATENCY__
+  uint64_t t_iret = rdtsc();
+  lat_record(ev.event, LAT_ENTRY,   t_call - t_entry);
+  lat_record(ev.event, LAT_HANDLER, t_ret - t_call);
+  lat_record(ev.event, LAT_EXIT,    t_iret - t_ret);
+  if (ret_ctx != saved_ctx) {
+    lat_record(ev.event, LAT_SWITCH, t_iret - t_entry);
+  }
+#endif
+
   __am_iret(ret_ctx);
 }
 
@@ -121,6 +200,7 @@ bool cte_init(Context *(*handler)(Event, Context *)) {
 }
 
 void yield() {
+  trace_event(TRACE_YIELD, (uintptr_t)__builtin_return_address(0), 0, 0);
   interrupt(0x81);
 }
 
@@ -35,7 +35,8 @@ static void uart_rx(AM_UART_RX_T *recv) {
 // ====================================================
 
 static AM_TIMER_RTC_T boot_date;
-static uint32_t freq_mhz = 2000;
+uint32_t __am_freq_mhz = 2000; // TSC ticks per microsecond, also used by trace.c
+bool __am_freq_estimated = false;
 static uint64_t uptsc;
 static void timer_rtc(AM_TIMER_RTC_T *rtc);
 
@@ -78,7 +79,8 @@ static uint32_t estimate_freq() {
 }
 
 static void timer_init() {
-  freq_mhz = estimate_freq();
+  __am_freq_mhz = estimate_freq();
+  __am_freq_estimated = true;
   timer_rtc(&boot_date);
   uptsc = rdtsc();
 }
@@ -96,12 +98,14 @@ static void timer_rtc(AM_TIMER_RTC_T *rtc) {
 }
 
 static void timer_uptime(AM_TIMER_UPTIME_T *upt) {
-  upt->us = (rdtsc() - uptsc) / freq_mhz;
+  upt->us = (rdtsc() - uptsc) / __am_freq_mhz;
 }
 
 // Input
 // ====================================================
 
+// Set 1 scancodes; keys sent with the 0xe0 prefix are in keylut_e0. The
+// keypad keys map to the navigation keys they have with Num Lock off.
 static int keylut[128] = {
   [0x01] = AM_KEY_ESCAPE,               [0x02] = AM_KEY_1, [0x03] = AM_KEY_2,
   [0x04] = AM_KEY_3, [0x05] = AM_KEY_4, [0x06] = AM_KEY_5, [0x07] = AM_KEY_6,
@@ -121,28 +125,84 @@ static int keylut[128] = {
   [0x2e] = AM_KEY_C, [0x2f] = AM_KEY_V, [0x30] = AM_KEY_B, [0x31] = AM_KEY_N,
   [0x32] = AM_KEY_M,     [0x33] = AM_KEY_COMMA,  [0x34] = AM_KEY_PERIOD,
   [0x35] = AM_KEY_SLASH, [0x36] = AM_KEY_RSHIFT, [0x38] = AM_KEY_LALT,
-  [0x38] = AM_KEY_RALT,  [0x39] = AM_KEY_SPACE,  [0x3a] = AM_KEY_CAPSLOCK,
+  [0x39] = AM_KEY_SPACE, [0x3a] = AM_KEY_CAPSLOCK,
   [0x3b] = AM_KEY_F1,    [0x3c] = AM_KEY_F2,     [0x3d] = AM_KEY_F3,
   [0x3e] = AM_KEY_F4,    [0x3f] = AM_KEY_F5,     [0x40] = AM_KEY_F6,
   [0x41] = AM_KEY_F7,    [0x42] = AM_KEY_F8,     [0x43] = AM_KEY_F9,
-  [0x44] = AM_KEY_F10,   [0x48] = AM_KEY_INSERT,
-  [0x4b] = AM_KEY_HOME,  [0x4d] = AM_KEY_END,    [0x50] = AM_KEY_DELETE,
-  [0x57] = AM_KEY_F11,   [0x58] = AM_KEY_F12,    [0x5b] = AM_KEY_APPLICATION,
+  [0x44] = AM_KEY_F10,   [0x47] = AM_KEY_HOME,   [0x48] = AM_KEY_UP,
+  [0x49] = AM_KEY_PAGEUP,                        [0x4b] = AM_KEY_LEFT,
+  [0x4d] = AM_KEY_RIGHT, [0x4f] = AM_KEY_END,    [0x50] = AM_KEY_DOWN,
+  [0x51] = AM_KEY_PAGEDOWN, [0x52] = AM_KEY_INSERT, [0x53] = AM_KEY_DELETE,
+  [0x57] = AM_KEY_F11,   [0x58] = AM_KEY_F12,
 };
 
+static int keylut_e0[128] = {
+  [0x1c] = AM_KEY_RETURN, [0x1d] = AM_KEY_RCTRL,  [0x35] = AM_KEY_SLASH,
+  [0x38] = AM_KEY_RALT,   [0x47] = AM_KEY_HOME,   [0x48] = AM_KEY_UP,
+  [0x49] = AM_KEY_PAGEUP,                         [0x4b] = AM_KEY_LEFT,
+  [0x4d] = AM_KEY_RIGHT,  [0x4f] = AM_KEY_END,    [0x50] = AM_KEY_DOWN,
+  [0x51] = AM_KEY_PAGEDOWN, [0x52] = AM_KEY_INSERT, [0x53] = AM_KEY_DELETE,
+  [0x5d] = AM_KEY_APPLICATION,
+};
+
+// Key events decoded from the 8042, filled by the IRQ1 handler and, with
+// interrupts off, by input_keybrd() itself. Events beyond a full ring are
+// dropped. The lock is held with interrupts off, as IRQ1 goes to CPU 0
+// while any CPU may read the keyboard.
+#define NR_KBD_EVENT 64
+#define KEYDOWN      0x8000
+
+static struct {
+  int lock, prefix, skip;
+  uint32_t head, tail;
+  uint16_t ev[NR_KBD_EVENT];
+} kbd;
+
+static void kbd_decode(int code) {
+  if (kbd.skip) { // the rest of Pause: e1 1d 45 e1 9d c5
+    kbd.skip--;
+    return;
+  }
+  switch (code) {
+    case 0xe0: kbd.prefix = 1; return;
+    case 0xe1: kbd.skip = 2;   return;
+  }
+  int key = (kbd.prefix ? keylut_e0 : keylut)[code & 0x7f];
+  kbd.prefix = 0;
+  if (key != AM_KEY_NONE && kbd.tail - kbd.head < NR_KBD_EVENT) {
+    kbd.ev[kbd.tail++ % NR_KBD_EVENT] = key | (code < 0x80 ? KEYDOWN : 0);
+  }
+}
+
+// Decodes all pending bytes of the keyboard (not of the mouse)
+static void kbd_drain() {
+  int status;
+  while ((status = inb(0x64)) & 0x1) {
+    int code = inb(0x60);
+    if (!(status & 0x20)) kbd_decode(code);
+  }
+}
+
+void __am_kbd_intr() {
+  while (xchg(&kbd.lock, 1)) pause();
+  kbd_drain();
+  xchg(&kbd.lock, 0);
+}
+
 static void input_config(AM_INPUT_CONFIG_T *cfg) {
   cfg->present = true;
 }
 
 static void input_keybrd(AM_INPUT_KEYBRD_T *ev) {
-  if (inb(0x64) & 0x1) {
-    int code = inb(0x60) & 0xff;
-    ev->keydown = code < 128;
-    ev->keycode = keylut[code & 0x7f];
-  } else {
-    ev->keydown = false;
-    ev->keycode = AM_KEY_NONE;
-  }
+  uint32_t efl = get_efl();
+  cli();
+  while (xchg(&kbd.lock, 1)) pause();
+  if (kbd.head == kbd.tail) kbd_drain(); // IRQ1 may be masked or not yet taken
+  int e = kbd.head != kbd.tail ? kbd.ev[kbd.head++ % NR_KBD_EVENT] : AM_KEY_NONE;
+  xchg(&kbd.lock, 0);
+  if (efl & FL_IF) sti();
+  ev->keydown = (e & KEYDOWN) != 0;
+  ev->keycode = e & ~KEYDOWN;
 }
 
 // GPU (Frame Buffer and 2D Accelerated Graphics)
@@ -300,6 +360,104 @@ static void disk_blkio(AM_DISK_BLKIO_T *bio) {
   }
 }
 
+// Performance Counters (Architectural PMU)
+// ====================================================
+
+#define MSR_PERFEVTSEL0          0x186
+#define MSR_PMC0                 0x0c1
+#define MSR_PERF_GLOBAL_STATUS   0x38e
+#define MSR_PERF_GLOBAL_CTRL     0x38f
+#define MSR_PERF_GLOBAL_OVF_CTRL 0x390
+#define EVTSEL_USR  (1 << 16)
+#define EVTSEL_OS   (1 << 17)
+#define EVTSEL_INT  (1 << 20) // raise a PMI on overflow
+#define EVTSEL_EN   (1 << 22)
+#define MAX_PMC     8
+
+static int pmu_version, pmu_nr, pmu_width;
+static uint32_t pmu_unavail; // bit set if an architectural event is not available
+static uint32_t pmu_period[MAX_CPU][MAX_PMC];
+
+static const struct {
+  uint8_t evtsel, umask, bit; // bit: in CPUID.0AH:EBX
+} pmu_events[] = {
+  [AM_PMU_CYCLES       ] = { 0x3c, 0x00, 0 },
+  [AM_PMU_INSTRUCTIONS ] = { 0xc0, 0x00, 1 },
+  [AM_PMU_LLC_MISSES   ] = { 0x2e, 0x41, 4 },
+  [AM_PMU_BRANCH_MISSES] = { 0xc5, 0x00, 6 },
+};
+
+static void pmu_init() {
+  uint32_t eax, ebx, ecx, edx;
+  cpuid(0, &eax, &ebx, &ecx, &edx);
+  if (eax < 0xa) return;
+  cpuid(0xa, &eax, &ebx, &ecx, &edx);
+  // TCG emulates no PMU and reports version 0, as do AMD CPUs
+  if ((eax & 0xff) == 0 || ((eax >> 8) & 0xff) == 0) return;
+  pmu_version = eax & 0xff;
+  pmu_nr      = (eax >> 8) & 0xff;
+  pmu_width   = (eax >> 16) & 0xff;
+  // events beyond the length of the EBX bit vector are not available
+  uint32_t len = eax >> 24;
+  pmu_unavail = (len >= 32 ? ebx : ebx | ~((1u << len) - 1));
+  if (pmu_nr > MAX_PMC) pmu_nr = MAX_PMC;
+}
+
+static void pmu_config(AM_PMU_CONFIG_T *cfg) {
+  cfg->present     = (pmu_version > 0);
+  cfg->nr_counters = pmu_nr;
+  cfg->width       = pmu_width;
+}
+
+static void pmu_ctrl(AM_PMU_CTRL_T *ctl) {
+  int i = ctl->counter, ev = ctl->event;
+  panic_on(i < 0 || i >= pmu_nr, "no such performance counter");
+  panic_on(ev < 0 || ev >= LENGTH(pmu_events), "unknown performance event");
+  // counters are written through their low 32 bits, sign-extended
+  panic_on(ctl->period >= (1u << 31), "PMU sampling period too large");
+
+  wrmsr(MSR_PERFEVTSEL0 + i, 0);
+  pmu_period[cpu_current()][i] = 0;
+  if (ev == AM_PMU_NONE) return;
+  panic_on(pmu_unavail & (1u << pmu_events[ev].bit), "performance event not available");
+
+  pmu_period[cpu_current()][i] = ctl->period;
+  wrmsr(MSR_PMC0 + i, -(uint64_t)ctl->period);
+  wrmsr(MSR_PERFEVTSEL0 + i, pmu_events[ev].evtsel | (pmu_events[ev].umask << 8) |
+        EVTSEL_USR | EVTSEL_OS | EVTSEL_EN | (ctl->period ? EVTSEL_INT : 0));
+  if (pmu_version >= 2) {
+    wrmsr(MSR_PERF_GLOBAL_CTRL, rdmsr(MSR_PERF_GLOBAL_CTRL) | (1u << i));
+  }
+}
+
+static void pmu_read(AM_PMU_READ_T *rd) {
+  for (int i = 0; i < LENGTH(rd->count); i++) {
+    rd->count[i] = (i < pmu_nr ? rdpmc(i) : 0);
+  }
+}
+
+// Called on a PMI: reloads the overflowed sampling counters and returns
+// their bitmap, which becomes the cause of EVENT_IRQ_PMI.
+uintptr_t __am_pmu_overflow() {
+  uint32_t *period = pmu_period[cpu_current()];
+  uint64_t status = 0;
+  if (pmu_version >= 2) {
+    status = rdmsr(MSR_PERF_GLOBAL_STATUS) & ((1u << pmu_nr) - 1);
+  } else {
+    // no status register: an overflowed counter has wrapped around to
+    // a small value, with the top bit clear
+    for (int i = 0; i < pmu_nr; i++) {
+      if (period[i] && !((rdpmc(i) >> (pmu_width - 1)) & 1)) status |= 1u << i;
+    }
+  }
+  for (int i = 0; i < pmu_nr; i++) {
+    if ((status & (1u << i)) && period[i]) wrmsr(MSR_PMC0 + i, -(uint64_t)period[i]);
+  }
+  if (pmu_version >= 2) wrmsr(MSR_PERF_GLOBAL_OVF_CTRL, status);
+  __am_lapic_unmask_pmi();
+  return status;
+}
+
 // ====================================================
 
 static void audio_config(AM_AUDIO_CONFIG_T *cfg) { cfg->present = false; }
@@ -326,6 +484,9 @@ static void *lut[128] = {
   [AM_DISK_STATUS ] = disk_status,
   [AM_DISK_BLKIO  ] = disk_blkio,
   [AM_NET_CONFIG  ] = net_config,
+  [AM_PMU_CONFIG  ] = pmu_config,
+  [AM_PMU_CTRL    ] = pmu_ctrl,
+  [AM_PMU_READ    ] = pmu_read,
 };
 
 
@@ -338,13 +499,59 @@ bool ioe_init() {
   uart_init();
   timer_init();
   gpu_init();
+  pmu_init();
 
+  boot_mark("ioe_init");
   return true;
 }
 
 void ioe_read (int reg, void *buf) { ((handler_t)lut[reg])(buf); }
 void ioe_write(int reg, void *buf) { ((handler_t)lut[reg])(buf); }
 
+// Merges the access to @reg with @buf into @cur when it continues @cur:
+// an FBDRAW of the rows right below from the rest of the same pixels, or
+// a BLKIO of the next blocks from/to the rest of the same buffer
+static bool coalesce(int reg, void *cur, const void *buf) {
+  switch (reg) {
+    case AM_GPU_FBDRAW: {
+      AM_GPU_FBDRAW_T *a = cur;
+      const AM_GPU_FBDRAW_T *b = buf;
+      if (b->x != a->x || b->w != a->w || b->y != a->y + a->h ||
+          b->pixels != (uint32_t *)a->pixels + a->w * a->h) return false;
+      a->h += b->h;
+      a->sync |= b->sync;
+      return true;
+    }
+    case AM_DISK_BLKIO: {
+      AM_DISK_BLKIO_T *a = cur;
+      const AM_DISK_BLKIO_T *b = buf;
+      if (b->write != a->write || b->blkno != a->blkno + a->blkcnt ||
+          b->buf != (uint8_t *)a->buf + a->blkcnt * BLKSZ) return false;
+      a->blkcnt += b->blkcnt;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ioe_batch(const IOEOp *ops, int n) {
+  for (int i = 0; i < n; ) {
+    int reg = ops[i].reg;
+    void *buf = ops[i++].buf;
+    union {
+      AM_GPU_FBDRAW_T fbdraw;
+      AM_DISK_BLKIO_T blkio;
+    } cur;
+    if (reg == AM_GPU_FBDRAW || reg == AM_DISK_BLKIO) {
+      if (reg == AM_GPU_FBDRAW) cur.fbdraw = *(AM_GPU_FBDRAW_T *)buf;
+      else                      cur.blkio  = *(AM_DISK_BLKIO_T *)buf;
+      while (i < n && ops[i].reg == reg && coalesce(reg, &cur, ops[i].buf)) i++;
+      buf = &cur;
+    }
+    ((handler_t)lut[reg])(buf);
+  }
+}
+
 // LAPIC/IOAPIC (from xv6)
 
 #define ID      (0x0020/4)   // ID
@@ -408,7 +615,7 @@ void __am_percpu_initlapic(void) {
   lapicw(LINT0, MASKED);
   lapicw(LINT1, MASKED);
   if (((__am_lapic[VER]>>16) & 0xFF) >= 4)
-    lapicw(PCINT, MASKED);
+    lapicw(PCINT, T_IRQ0 + IRQ_PMI);
   lapicw(ERROR, T_IRQ0 + IRQ_ERROR);
   lapicw(ESR, 0);
   lapicw(ESR, 0);
@@ -419,6 +626,11 @@ void __am_percpu_initlapic(void) {
   lapicw(TPR, 0);
 }
 
+// the LVT entry is masked by the CPU when a PMI is delivered
+void __am_lapic_unmask_pmi(void) {
+  lapicw(PCINT, T_IRQ0 + IRQ_PMI);
+}
+
 void __am_lapic_eoi(void) {
   if (__am_lapic)
     lapicw(EOI, 0);
@@ -430,6 +642,7 @@ void __am_lapic_bootap(uint32_t apicid, void *addr) {
   outb(0x70, 0xF);
   outb(0x71, 0x0A);
   wrv = (unsigned short*)((0x40<<4 | 0x67));
+  asm ("" : "+r"(wrv)); // not a C object: keep gcc from bounds-checking it
   wrv[0] = 0;
   wrv[1] = (uintptr_t)addr >> 4;
 
@@ -19,6 +19,7 @@ bool mpe_init(void (*entry)()) {
       pause();
     }
   }
+  boot_mark("mpe_init");
   call_user_entry();
   return true;
 }
@@ -30,6 +31,7 @@ static void othercpu_entry() {
 }
 
 void __am_othercpu_entry() {
+  __am_percpu_initgdt(__am_lapic[8] >> 24);
   stack_switch_call(stack_top(&CPU->stack), othercpu_entry, 0);
 }
 
@@ -38,13 +40,56 @@ int cpu_count() {
 }
 
 int cpu_current(void) {
-  return __am_lapic[8] >> 24;
+  int cpu;
+  asm volatile ("movl %%gs:%c1, %0" : "=r"(cpu) : "i"(offsetof(struct cpu_local, cpu)));
+  return cpu;
+}
+
+void *cpu_data(void) {
+  return CPU->data;
 }
 
 int atomic_xchg(int *addr, int newval) {
   return xchg(addr, newval);
 }
 
+int atomic_cmpxchg(int *addr, int oldval, int newval) {
+  return cmpxchg(addr, oldval, newval);
+}
+
+int atomic_fetchadd(int *addr, int val) {
+  return xadd(addr, val);
+}
+
+int atomic_fetchor(int *addr, int mask) {
+  int old = *(volatile int *)addr, cur;
+  while ((cur = cmpxchg(addr, old, old | mask)) != old) old = cur;
+  return old;
+}
+
+int atomic_fetchand(int *addr, int mask) {
+  int old = *(volatile int *)addr, cur;
+  while ((cur = cmpxchg(addr, old, old & mask)) != old) old = cur;
+  return old;
+}
+
+// x86 is TSO: plain loads/stores already have acquire/release semantics,
+// only the compiler has to be kept from reordering around them
+int atomic_load_acquire(int *addr) {
+  int val = *(volatile int *)addr;
+  asm volatile ("" : : : "memory");
+  return val;
+}
+
+void atomic_store_release(int *addr, int val) {
+  asm volatile ("" : : : "memory");
+  *(volatile int *)addr = val;
+}
+
+void atomic_fence() {
+  mfence();
+}
+
 void __am_stop_the_world() {
   boot_record()->jmp_code = 0x0000feeb; // (16-bit) jmp .
   for (int cpu_ = 0; cpu_ < __am_ncpu; cpu_++) {
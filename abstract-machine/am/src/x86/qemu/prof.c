@@ -0,0 +1,115 @@
+#include "x86-qemu.h"
+
+// Per-CPU histograms of sampled call stacks, as open-addressing hash
+// tables. Samples are taken in the timer interrupt handler of the CPU
+// owning the table, so no synchronization is needed.
+
+#define NR_PROBE    16
+#define STACK_LIMIT (1 << 16) // frame pointers farther than this from sp are bogus
+
+struct table {
+  uintptr_t *bucket; // count, pc, return addresses (0-terminated)
+  uint32_t mask, ticks, samples, lost;
+};
+
+static struct table tables[MAX_CPU];
+static int period, depth;
+static volatile bool enabled = false;
+
+bool prof_init(Area buf, int every, int max_depth) {
+  if (every < 1 || max_depth < 0 || max_depth > PROF_MAX_DEPTH) return false;
+  uintptr_t start = ROUNDUP(buf.start, sizeof(uintptr_t));
+  int words = 2 + max_depth;
+  uint32_t nr = ((uintptr_t)buf.end - start) / sizeof(uintptr_t) / words / __am_ncpu;
+  if (nr == 0) return false;
+  while (nr & (nr - 1)) nr &= nr - 1; // round down to a power of 2
+
+  for (uintptr_t *p = (uintptr_t *)start; p < (uintptr_t *)start + nr * words * __am_ncpu; p++) {
+    *p = 0;
+  }
+  for (int i = 0; i < __am_ncpu; i++) {
+    tables[i] = (struct table) {
+      .bucket = (uintptr_t *)start + i * nr * words,
+      .mask   = nr - 1,
+    };
+  }
+  period = every;
+  depth = max_depth;
+  enabled = true;
+  return true;
+}
+
+static void record(struct table *t, const uintptr_t *key) {
+  int words = 2 + depth;
+  uint32_t h = 2166136261u;
+  for (int i = 0; i <= depth; i++) h = (h ^ key[i]) * 16777619u;
+
+  for (int probe = 0; probe < NR_PROBE; probe++) {
+    uintptr_t *b = t->bucket + ((h + probe) & t->mask) * words;
+    if (b[0] == 0) {
+      for (int i = 0; i <= depth; i++) b[1 + i] = key[i];
+      b[0] = 1;
+      return;
+    }
+    int i = 0;
+    while (i <= depth && b[1 + i] == key[i]) i++;
+    if (i > depth) { b[0]++; return; }
+  }
+  t->lost++;
+}
+
+void __am_prof_sample(uintptr_t pc, uintptr_t fp, uintptr_t sp, bool user) {
+  if (!enabled) return;
+  struct table *t = &tables[cpu_current()];
+  if (++t->ticks % period != 0) return;
+  t->samples++;
+
+  uintptr_t key[PROF_MAX_DEPTH + 1] = { pc };
+  // never follow the frames of the user address space
+  for (int n = 1; n <= depth && !user; n++) {
+    if (fp - sp >= STACK_LIMIT || fp % sizeof(uintptr_t) != 0) break;
+    uintptr_t *frame = (uintptr_t *)fp;
+    if ((key[n] = frame[1]) == 0 || frame[0] <= fp) break;
+    fp = frame[0];
+  }
+  record(t, key);
+}
+
+static void put_num(uintptr_t x, int base) {
+  char buf[24];
+  int i = 0;
+  do { buf[i++] = "0123456789abcdef"[x % base]; x /= base; } while (x);
+  if (base == 16) putstr("0x");
+  while (i > 0) putch(buf[--i]);
+}
+
+// The histograms are printed on the serial console between two marker
+// lines, for scripts/amprof.py to pick out of the captured output.
+void prof_dump() {
+  if (!enabled) return;
+  enabled = false;
+
+  extern char _start;
+  int words = 2 + depth;
+  putstr("\n=== AMPROF BEGIN ===\nstart "); put_num((uintptr_t)&_start, 16);
+  putch('\n');
+  for (int i = 0; i < __am_ncpu; i++) {
+    struct table *t = &tables[i];
+    putstr("cpu ");      put_num(i, 10);
+    putstr(" samples "); put_num(t->samples, 10);
+    putstr(" lost ");    put_num(t->lost, 10);
+    putch('\n');
+    for (uint32_t k = 0; k <= t->mask; k++) {
+      uintptr_t *b = t->bucket + k * words;
+      if (b[0] == 0) continue;
+      put_num(b[0], 10);
+      for (int n = 0; n <= depth && b[1 + n] != 0; n++) {
+        putch(' '); put_num(b[1 + n], 16);
+      }
+      putch('\n');
+    }
+  }
+  putstr("=== AMPROF END ===\n");
+
+  enabled = true;
+}
@@ -0,0 +1,83 @@
+#include "x86-qemu.h"
+
+// Per-CPU rings of trace records. Only the owning CPU writes its ring, so
+// a slot is claimed by an atomic increment of the head, which is enough
+// to keep nested interrupts on the same CPU from sharing a slot. When a
+// ring is full, the oldest records are overwritten.
+
+struct ring {
+  TraceRecord *rec;
+  int head;
+  uint32_t mask;
+};
+
+static struct ring rings[MAX_CPU];
+static volatile bool enabled = false;
+
+bool trace_init(Area buf) {
+  uintptr_t start = ROUNDUP(buf.start, 8);
+  uint32_t nr = ((uintptr_t)buf.end - start) / sizeof(TraceRecord) / __am_ncpu;
+  if (nr == 0) return false;
+  while (nr & (nr - 1)) nr &= nr - 1; // round down to a power of 2
+
+  for (int i = 0; i < __am_ncpu; i++) {
+    rings[i] = (struct ring) {
+      .rec  = (TraceRecord *)start + i * nr,
+      .head = 0,
+      .mask = nr - 1,
+    };
+  }
+  enabled = true;
+  return true;
+}
+
+void trace_event(int id, uintptr_t a0, uintptr_t a1, uintptr_t a2) {
+  if (!enabled) return;
+  int cpu = cpu_current();
+  struct ring *r = &rings[cpu];
+  TraceRecord *rec = &r->rec[(uint32_t)xadd(&r->head, 1) & r->mask];
+  *rec = (TraceRecord) {
+    .ts  = rdtsc(),
+    .id  = id, .cpu = cpu,
+    .arg = { a0, a1, a2 },
+  };
+}
+
+static int hex_col;
+
+static void dump_hex(const void *data, int len) {
+  for (const uint8_t *p = data; p < (uint8_t *)data + len; p++) {
+    putch("0123456789abcdef"[*p >> 4]);
+    putch("0123456789abcdef"[*p & 0xf]);
+    if (++hex_col == 32) { putch('\n'); hex_col = 0; }
+  }
+}
+
+// The serial port is a text console (and "-serial mon:stdio" takes ^A as
+// an escape), so the binary dump is sent hex-encoded between two marker
+// lines, for scripts/amtrace.py to pick out of the captured output.
+void trace_dump() {
+  if (!enabled) return;
+  enabled = false;
+
+  extern uint32_t __am_freq_mhz;
+  TraceHeader hdr = {
+    .magic   = "AMTRACE",
+    .version = 1,
+    .ncpu    = __am_ncpu,
+    .ts_hz   = (uint64_t)__am_freq_mhz * 1000000,
+  };
+  putstr("\n=== AMTRACE BEGIN ===\n");
+  hex_col = 0;
+  dump_hex(&hdr, sizeof(hdr));
+  for (int i = 0; i < __am_ncpu; i++) {
+    struct ring *r = &rings[i];
+    uint32_t head = r->head, n = r->mask + 1;
+    for (uint32_t k = (head > n ? head - n : 0); k != head; k++) {
+      dump_hex(&r->rec[k & r->mask], sizeof(TraceRecord));
+    }
+  }
+  putstr("\n=== AMTRACE END ===\n");
+
+  enabled = true;
+}
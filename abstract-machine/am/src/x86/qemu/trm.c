@@ -6,6 +6,9 @@ int __am_ncpu = 0;
 int main(const char *args);
 
 static void call_main(const char *args) {
+#ifdef __AM_BOOT_TIMING__
+  boot_report();
+#endif
   halt(main(args));
 }
 
@@ -13,20 +16,25 @@ void _start_c(char *args) {
   if (boot_record()->is_ap) {
     __am_othercpu_entry();
   } else {
+    __am_boot_init();
     __am_bootcpu_init();
     stack_switch_call(stack_top(&CPU->stack), call_main, (uintptr_t)args);
   }
 }
 
 void __am_bootcpu_init() {
+  __am_percpu_initgdt(0);
   heap = __am_heap_init();
+  boot_mark("heap_init");
   __am_lapic_init();
+  boot_mark("lapic_init");
   __am_ioapic_init();
+  boot_mark("ioapic_init");
   __am_percpu_init();
+  boot_mark("percpu_init");
 }
 
 void __am_percpu_init() {
-  __am_percpu_initgdt();
   __am_percpu_initlapic();
   __am_percpu_initirq();
 }
@@ -67,46 +75,126 @@ Area __am_heap_init() {
   return RANGE(ROUNDUP(&end, 1 << 20), (uintptr_t)((lo | hi << 8) << 16));
 }
 
-void __am_lapic_init() {
-  for (char *st = (char *)0xf0000; st != (char *)0xffffff; st ++) {
-    if (*(volatile uint32_t *)st == 0x5f504d5f) {
-      uint32_t mpconf_ptr = ((volatile MPDesc *)st)->conf;
-      MPConf *conf = (void *)((uintptr_t)(mpconf_ptr));
-      __am_lapic = (void *)((uintptr_t)(conf->lapicaddr));
-      for (volatile char *ptr = (char *)(conf + 1);
-           ptr < (char *)conf + conf->length; ptr += 8) {
-        if (*ptr == '\0') {
-          ptr += 12;
-          panic_on(++__am_ncpu > MAX_CPU, "cannot support > MAX_CPU processors");
-        }
+static bool checksum_ok(const volatile void *p, int len) {
+  uint8_t sum = 0;
+  for (int i = 0; i < len; i++) sum += ((const volatile uint8_t *)p)[i];
+  return sum == 0;
+}
+
+static bool sig_eq(const volatile void *p, const char *sig, int len) {
+  for (int i = 0; i < len; i++) {
+    if (((const volatile char *)p)[i] != sig[i]) return false;
+  }
+  return true;
+}
+
+// The MP floating pointer and the ACPI RSDP are 16-byte aligned in the
+// first KB of the EBDA, or in the BIOS ROM area [0xe0000, 0x100000)
+static void *bios_find(const char *sig, int len, int cklen) {
+  // the BDA word at 0x40e holds the EBDA segment; the address is hidden
+  // from gcc, which takes a dereference of a constant for an empty array
+  volatile uint16_t *bda = (void *)0x40e;
+  asm ("" : "+r"(bda));
+  uintptr_t ebda = (uintptr_t)*bda << 4;
+  const struct { uintptr_t start, end; } areas[] = {
+    { ebda, ebda ? ebda + 1024 : 0 },
+    { 0xe0000, 0x100000 },
+  };
+  for (int i = 0; i < LENGTH(areas); i++) {
+    for (uintptr_t p = areas[i].start; p < areas[i].end; p += 16) {
+      if (sig_eq((void *)p, sig, len) && checksum_ok((void *)p, cklen)) {
+        return (void *)p;
+      }
+    }
+  }
+  return NULL;
+}
+
+// Counts the enabled processors in the ACPI MADT
+// A table is taken only with its signature, a length between its fixed
+// part and 64 KiB (far above what QEMU or real firmware emits for the RSDT
+// or MADT), and a checksum over that length
+static bool acpi_table_ok(ACPIHeader *hdr, const char *sig, uint32_t minlen) {
+  return sig_eq(hdr->signature, sig, 4) &&
+         hdr->length >= minlen && hdr->length <= 0x10000 &&
+         checksum_ok(hdr, hdr->length);
+}
+
+static bool acpi_init() {
+  ACPIRsdp *rsdp = bios_find("RSD PTR ", 8, 20);
+  if (!rsdp) return false;
+  ACPIHeader *rsdt = (void *)(uintptr_t)rsdp->rsdt;
+  if (!acpi_table_ok(rsdt, "RSDT", sizeof(*rsdt))) return false;
+
+  uint32_t *entry = (uint32_t *)(rsdt + 1);
+  int nr_entry = (rsdt->length - sizeof(*rsdt)) / sizeof(uint32_t);
+  for (int i = 0; i < nr_entry; i++) {
+    ACPIMadt *madt = (void *)(uintptr_t)entry[i];
+    if (!acpi_table_ok(&madt->hdr, "APIC", sizeof(*madt))) continue;
+
+    __am_lapic = (void *)(uintptr_t)madt->lapicaddr;
+    for (volatile uint8_t *ptr = (uint8_t *)(madt + 1);
+         ptr < (uint8_t *)madt + madt->hdr.length && ptr[1] != 0; ptr += ptr[1]) {
+      // processor local APIC: type, length, ACPI id, APIC id, flags
+      if (ptr[0] == 0 && (ptr[4] & 0x1)) {
+        panic_on(++__am_ncpu > MAX_CPU, "cannot support > MAX_CPU processors");
       }
-      return;
+    }
+    return __am_ncpu > 0;
+  }
+  return false;
+}
+
+static bool mp_init() {
+  volatile MPDesc *mp = bios_find("_MP_", 4, sizeof(MPDesc));
+  if (!mp) return false;
+  MPConf *conf = (void *)((uintptr_t)(mp->conf));
+  __am_lapic = (void *)((uintptr_t)(conf->lapicaddr));
+  for (volatile char *ptr = (char *)(conf + 1);
+       ptr < (char *)conf + conf->length; ptr += 8) {
+    if (*ptr == '\0') {
+      ptr += 12;
+      panic_on(++__am_ncpu > MAX_CPU, "cannot support > MAX_CPU processors");
     }
   }
+  return true;
+}
+
+void __am_lapic_init() {
+  if (acpi_init()) return;
+  __am_ncpu = 0;
+  if (mp_init()) return;
   bug();
 }
 
-void __am_percpu_initgdt() {
+// Also points %gs to the per-CPU area, so it comes first on each CPU
+void __am_percpu_initgdt(int cpu) {
+  struct cpu_local *c = &__am_cpuinfo[cpu];
+  c->self = c;
+  c->cpu  = cpu;
 #if __x86_64__
-  SegDesc *gdt = CPU->gdt;
-  TSS64 *tss = &CPU->tss;
+  SegDesc *gdt = c->gdt;
+  TSS64 *tss = &c->tss;
   gdt[SEG_KCODE] = SEG64(STA_X | STA_R,                      DPL_KERN);
   gdt[SEG_KDATA] = SEG64(STA_W,                              DPL_KERN);
   gdt[SEG_UCODE] = SEG64(STA_X | STA_R,                      DPL_USER);
   gdt[SEG_UDATA] = SEG64(STA_W,                              DPL_USER);
   gdt[SEG_TSS]   = SEG16(STS_T32A,      tss, sizeof(*tss)-1, DPL_KERN);
   bug_on((uintptr_t)tss >> 32);
-  set_gdt(gdt, sizeof(gdt[0]) * (NR_SEG + 1));
+  set_gdt(gdt, sizeof(gdt[0]) * NR_SEG);
   set_tr(KSEL(SEG_TSS));
+  wrmsr(MSR_GS_BASE, (uintptr_t)c);
 #else
-  SegDesc *gdt = CPU->gdt;
-  TSS32 *tss = &CPU->tss;
+  SegDesc *gdt = c->gdt;
+  TSS32 *tss = &c->tss;
   gdt[SEG_KCODE] = SEG32(STA_X | STA_R,   0,     0xffffffff, DPL_KERN);
   gdt[SEG_KDATA] = SEG32(STA_W,           0,     0xffffffff, DPL_KERN);
   gdt[SEG_UCODE] = SEG32(STA_X | STA_R,   0,     0xffffffff, DPL_USER);
   gdt[SEG_UDATA] = SEG32(STA_W,           0,     0xffffffff, DPL_USER);
   gdt[SEG_TSS]   = SEG16(STS_T32A,      tss, sizeof(*tss)-1, DPL_KERN);
+  gdt[SEG_KCPU]  = SEG32(STA_W,           c,     0xffffffff, DPL_KERN);
   set_gdt(gdt, sizeof(gdt[0]) * NR_SEG);
   set_tr(KSEL(SEG_TSS));
+  asm volatile ("movw %w0, %%gs" : : "r"(KSEL(SEG_KCPU)));
 #endif
 }
@@ -3,12 +3,15 @@
 #define PML4_ADDR  0x1000
 #define PDPT_ADDR  0x2000
 
-#define NR_SEG         6       // GDT size
+#define NR_SEG         7       // GDT size
 #define SEG_KCODE      1       // Kernel code
 #define SEG_KDATA      2       // Kernel data/stack
 #define SEG_UCODE      3       // User code
 #define SEG_UDATA      4       // User data/stack
 #define SEG_TSS        5       // Global unique task state segement
+#define SEG_KCPU       6       // Per-CPU data in %gs (i386; the x86-64 TSS takes two slots)
+
+#define MSR_GS_BASE    0xc0000101
 
 #define NR_IRQ         256     // IDT size
 
@@ -41,16 +44,21 @@ struct vm_area {
 
 void __am_iret(Context *ctx);
 
+// Addressed by %gs in the kernel: through GS_BASE on x86-64 (swapped with
+// the user's on traps from and returns to user mode) and through the
+// SEG_KCPU segment on i386 (loaded on trap entry)
 struct cpu_local {
+  struct cpu_local *self;
+  int cpu;
   AddrSpace *uvm;
+  SegDesc gdt[NR_SEG];
 #if __x86_64__
-  SegDesc gdt[NR_SEG + 1];
   TSS64 tss;
 #else
-  SegDesc gdt[NR_SEG];
   TSS32 tss;
 #endif
   struct kernel_stack stack;
+  uint8_t data[CPU_DATA_SIZE];
 };
 
 #if __x86_64__
@@ -71,7 +79,14 @@ extern volatile uint32_t *__am_lapic;
 extern int __am_ncpu;
 extern struct cpu_local __am_cpuinfo[MAX_CPU];
 
-#define CPU (&__am_cpuinfo[cpu_current()])
+// volatile, as a kernel thread may move to another CPU in between
+static inline struct cpu_local *cpu_local() {
+  struct cpu_local *c;
+  asm volatile ("mov %%gs:%c1, %0" : "=r"(c) : "i"(offsetof(struct cpu_local, self)));
+  return c;
+}
+
+#define CPU (cpu_local())
 
 #define bug_on(cond) \
   do { \
@@ -82,19 +97,24 @@ extern struct cpu_local __am_cpuinfo[MAX_CPU];
 
 // apic utils
 void __am_lapic_eoi();
+void __am_lapic_unmask_pmi();
+uintptr_t __am_pmu_overflow();
 void __am_ioapic_init();
 void __am_lapic_bootap(uint32_t cpu, void *address);
 void __am_ioapic_enable(int irq, int cpu);
+void __am_kbd_intr();
 
 // x86-specific operations
+void __am_boot_init();
 void __am_bootcpu_init();
 void __am_percpu_init();
 Area __am_heap_init();
 void __am_lapic_init();
 void __am_othercpu_entry();
 void __am_percpu_initirq();
-void __am_percpu_initgdt();
+void __am_percpu_initgdt(int cpu);
 void __am_percpu_initlapic();
 void __am_stop_the_world();
+void __am_prof_sample(uintptr_t pc, uintptr_t fp, uintptr_t sp, bool user);
 
 #endif
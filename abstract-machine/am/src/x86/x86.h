@@ -35,6 +35,7 @@
 #define IRQ_TIMER      0
 #define IRQ_KBD        1
 #define IRQ_COM1       4
+#define IRQ_PMI        18
 #define IRQ_ERROR      19
 #define IRQ_SPURIOUS   31
 #define EX_DE          0
@@ -87,6 +88,7 @@
   _( 45, KERN, NOERR) \
   _( 46, KERN, NOERR) \
   _( 47, KERN, NOERR) \
+  _( 50, KERN, NOERR) \
   _(128, USER, NOERR) \
   _(129, USER, NOERR)
 
@@ -185,9 +187,35 @@ typedef struct {
   uint8_t  reserved[3];
 } MPDesc;
 
+// ACPI tables
+typedef struct {
+  char     signature[8]; // "RSD PTR "
+  uint8_t  checksum;     // first 20 bytes add to 0
+  char     oemid[6];
+  uint8_t  revision;
+  uint32_t rsdt;         // RSDT physical address
+} __attribute__((packed)) ACPIRsdp;
+
+typedef struct {         // header of the RSDT, MADT, ...
+  char     signature[4];
+  uint32_t length;       // total table length
+  uint8_t  revision;
+  uint8_t  checksum;     // all bytes add to 0
+  char     oemid[6];
+  char     oemtable[8];
+  uint32_t oemrev, creator, creatorrev;
+} __attribute__((packed)) ACPIHeader;
+
+typedef struct {
+  ACPIHeader hdr;        // "APIC"
+  uint32_t lapicaddr;    // address of local APIC
+  uint32_t flags;        // followed by entries of (type, length, ...)
+} __attribute__((packed)) ACPIMadt;
+
 typedef struct {
   uint32_t jmp_code;
   int32_t is_ap;
+  uint64_t tsc; // stamped by the boot loader on entry
 } BootRecord;
 
 #define SEG16(type, base, lim, dpl) (SegDesc)        \
@@ -327,12 +355,56 @@ static inline int xchg(int *addr, int newval) {
   return result;
 }
 
+static inline int cmpxchg(int *addr, int oldval, int newval) {
+  int result;
+  asm volatile ("lock cmpxchg %2, %1":
+    "=a"(result), "+m"(*addr) : "r"(newval), "0"(oldval) : "cc", "memory");
+  return result;
+}
+
+static inline int xadd(int *addr, int val) {
+  asm volatile ("lock xadd %0, %1":
+    "+r"(val), "+m"(*addr) : : "cc", "memory");
+  return val;
+}
+
+static inline void mfence() {
+#if __x86_64__
+  asm volatile ("mfence" : : : "memory");
+#else
+  // -march=i386 has no mfence; a locked no-op is a full barrier as well
+  asm volatile ("lock addl $0, (%%esp)" : : : "cc", "memory");
+#endif
+}
+
 static inline uint64_t rdtsc() {
   uint32_t lo, hi;
   asm volatile ("rdtsc": "=a"(lo), "=d"(hi));
   return ((uint64_t)hi << 32) | lo;
 }
 
+static inline void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx,
+                         uint32_t *ecx, uint32_t *edx) {
+  asm volatile ("cpuid": "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                       : "a"(leaf), "c"(0));
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+  uint32_t lo, hi;
+  asm volatile ("rdmsr": "=a"(lo), "=d"(hi) : "c"(msr));
+  return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t val) {
+  asm volatile ("wrmsr": : "c"(msr), "a"((uint32_t)val), "d"((uint32_t)(val >> 32)));
+}
+
+static inline uint64_t rdpmc(uint32_t counter) {
+  uint32_t lo, hi;
+  asm volatile ("rdpmc": "=a"(lo), "=d"(hi) : "c"(counter));
+  return ((uint64_t)hi << 32) | lo;
+}
+
 #define interrupt(id) \
   asm volatile ("int $" #id);
 
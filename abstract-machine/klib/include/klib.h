@@ -38,6 +38,16 @@ int    snprintf  (char *str, size_t size, const char *format, ...);
 int    vsprintf  (char *str, const char *format, va_list ap);
 int    vsnprintf (char *str, size_t size, const char *format, va_list ap);
 
+// int64.c: division by an invariant divisor without a divide instruction
+typedef struct {
+  uint64_t magic;
+  uint8_t  shift, add;
+} udiv64_t;
+void     udiv64_init    (udiv64_t *r, uint64_t d);
+uint64_t udiv64         (uint64_t n, const udiv64_t *r);
+uint64_t udiv64_10      (uint64_t n);
+uint64_t udiv64_1000000 (uint64_t n);
+
 // assert.h
 #ifdef NDEBUG
   #define assert(ignore) ((void)0)
@@ -362,6 +362,7 @@ uint32_t __inline __builtin_clzll(uint64_t value) {
 #endif /* defined(_MSC_VER) && !defined(__clang__) */
 
 #include <am.h>
+#include <klib.h>
 
 #if !defined(__ARCH_RISCV64_MYCPU)
 /* Returns: a / b */
@@ -538,6 +539,25 @@ __udivmoddi4(du_int a, du_int b, du_int* rem)
                 q.s.low = (n.s.high << (n_uword_bits - sr)) | (n.s.low >> sr);
                 return q.all;
             }
+#if defined(__i386__)
+            /* K X
+             * ---
+             * 0 K
+             *
+             * Let the hardware do it with two divl: first the high word,
+             * then (remainder:low word), whose quotient fits in 32 bits
+             * because the remainder is less than d.
+             */
+            {
+                su_int r_high = n.s.high % d.s.low;
+                q.s.high = n.s.high / d.s.low;
+                __asm__ ("divl %4" : "=a"(q.s.low), "=d"(r.s.low)
+                                   : "a"(n.s.low), "d"(r_high), "rm"(d.s.low));
+                if (rem)
+                    *rem = r.s.low;
+                return q.all;
+            }
+#endif
             /* K X
              * ---
              * 0 K
@@ -729,3 +749,69 @@ si_int __clzdi2(di_int a) {
   return __clzsi2((x.s.high & ~f) | (x.s.low & f)) +
          (f & ((si_int)(sizeof(si_int) * CHAR_BIT)));
 }
+
+// Division by an invariant divisor as a multiplication by its reciprocal
+// (Granlund and Montgomery, "Division by Invariant Integers using
+// Multiplication"). For a divisor d that is not a power of 2, with
+// l = floor(log2(d)), magic = ceil(2^(64+l) / d) may need 65 bits; in
+// that case the low 64 bits are kept and the missing 2^64 * n is folded
+// back by the "add" step of udiv64().
+
+static inline uint64_t mulhi64(uint64_t a, uint64_t b) {
+#ifdef CRT_HAS_128BIT
+  return (uint64_t)(((tu_int)a * b) >> 64);
+#else
+  // four 32x32->64 products, which are single mull on i386
+  uint64_t a0 = (uint32_t)a, a1 = a >> 32;
+  uint64_t b0 = (uint32_t)b, b1 = b >> 32;
+  uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+  uint64_t mid = (p00 >> 32) + (uint32_t)p01 + (uint32_t)p10;
+  return p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+#endif
+}
+
+void udiv64_init(udiv64_t *r, uint64_t d) {
+  assert(d != 0);
+  int l = 63 - __builtin_clzll(d);
+  r->shift = l;
+  r->add = 0;
+  if ((d & (d - 1)) == 0) {
+    r->magic = 0; // a plain shift
+    return;
+  }
+
+  // m = 2^(64+l) / d by long division; it fits in 64 bits since 2^l < d
+  uint64_t m = 0, rem = 1ull << l;
+  for (int i = 0; i < 64; i ++) {
+    uint64_t carry = rem >> 63;
+    rem <<= 1;
+    m <<= 1;
+    if (carry || rem >= d) { rem -= d; m |= 1; }
+  }
+
+  if (d - rem >= (1ull << l)) {
+    // ceil(2^(64+l) / d) is not precise enough; use 2^(65+l) / d instead
+    uint64_t rem2 = rem + rem;
+    m += m;
+    if (rem2 >= d || rem2 < rem) m ++;
+    r->add = 1;
+  }
+  r->magic = m + 1;
+}
+
+uint64_t udiv64(uint64_t n, const udiv64_t *r) {
+  if (r->magic == 0) return n >> r->shift;
+  uint64_t q = mulhi64(r->magic, n);
+  if (r->add) return (((n - q) >> 1) + q) >> r->shift;
+  return q >> r->shift;
+}
+
+// the common constant divisors, with precomputed magic numbers
+
+uint64_t udiv64_10(uint64_t n) {
+  return mulhi64(n, 0xcccccccccccccccdull) >> 3;
+}
+
+uint64_t udiv64_1000000(uint64_t n) {
+  return mulhi64(n, 0x8637bd05af6c69b6ull) >> 19;
+}
@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+# Symbolize a dump of prof_dump() against the image it was taken from.
+#
+# usage: amprof.py [--folded FILE] [-n N] ELF DUMP
+#
+# ELF is build/*.elf (or build/*-native on native), DUMP is either the file
+# written on native or the captured serial output of x86-qemu (the last dump
+# is used). Prints a flat profile; --folded writes the call stacks in the
+# folded format of flamegraph.pl. Call stacks need frame pointers, which
+# are kept by default only on x86-qemu (elsewhere, add -fno-omit-frame-pointer
+# to CFLAGS). Even so, gcc sets up no frame in simple leaf functions, so the
+# caller of an interrupted leaf function is missing from its stacks.
+
+import argparse, bisect, collections, subprocess, sys
+
+def load_symbols(elf):
+    out = subprocess.run(['nm', '-n', '-S', '--defined-only', elf],
+                         capture_output=True, text=True, check=True).stdout
+    addrs, sizes, names = [], [], []
+    for line in out.splitlines():
+        f = line.split()
+        if len(f) == 4 and f[2] in 'tTwW':
+            addrs.append(int(f[0], 16)); sizes.append(int(f[1], 16)); names.append(f[3])
+        elif len(f) == 3 and f[1] in 'tT': # no size, e.g., assembly labels
+            addrs.append(int(f[0], 16)); sizes.append(None); names.append(f[2])
+    # let a symbol without size extend to the next one
+    for i in range(len(addrs)):
+        if sizes[i] is None:
+            sizes[i] = addrs[i + 1] - addrs[i] if i + 1 < len(addrs) else 0
+    return addrs, sizes, names
+
+def load_dump(path):
+    text = open(path, errors='replace').read()
+    begin = text.rfind('=== AMPROF BEGIN ===')
+    end = text.find('=== AMPROF END ===', begin)
+    if begin < 0 or end < 0:
+        sys.exit('amprof: no profile dump found')
+    start, samples, lost, stacks = 0, 0, 0, collections.Counter()
+    for line in text[begin:end].splitlines()[1:]:
+        f = line.split()
+        if not f: continue
+        if f[0] == 'start':
+            start = int(f[1], 16)
+        elif f[0] == 'cpu':
+            samples += int(f[3]); lost += int(f[5])
+        else:
+            stacks[tuple(int(x, 16) for x in f[1:])] += int(f[0])
+    return start, samples, lost, stacks
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument('elf')
+    ap.add_argument('dump')
+    ap.add_argument('--folded', help='write folded stacks to this file')
+    ap.add_argument('-n', type=int, default=30, help='number of functions to list')
+    args = ap.parse_args()
+
+    addrs, sizes, names = load_symbols(args.elf)
+    start, samples, lost, stacks = load_dump(args.dump)
+    # position-independent images (native) are loaded at a random address
+    bias = start - addrs[names.index('_start')] if '_start' in names else 0
+
+    def symbolize(addr, is_ret):
+        # a return address may be just past the end of the calling function
+        pc = addr - bias - is_ret
+        i = bisect.bisect_right(addrs, pc) - 1
+        if i < 0 or pc >= addrs[i] + sizes[i]:
+            return '%#x' % addr # e.g., in a shared library on native
+        return names[i]
+
+    self_cnt, total_cnt, folded = collections.Counter(), collections.Counter(), collections.Counter()
+    for stack, n in stacks.items():
+        funcs = [symbolize(a, k > 0) for k, a in enumerate(stack)]
+        self_cnt[funcs[0]] += n
+        for fn in set(funcs):
+            total_cnt[fn] += n
+        folded[';'.join(reversed(funcs))] += n
+
+    recorded = sum(stacks.values())
+    print('%d samples, %d lost (hash table full)' % (samples, lost))
+    print('%7s %7s %8s  %s' % ('self%', 'total%', 'self', 'function'))
+    for fn, n in self_cnt.most_common(args.n):
+        print('%6.2f%% %6.2f%% %8d  %s' % (100 * n / recorded, 100 * total_cnt[fn] / recorded, n, fn))
+
+    if args.folded:
+        with open(args.folded, 'w') as f:
+            for stack, n in sorted(folded.items()):
+                f.write('%s %d\n' % (stack, n))
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+# Decode a dump of trace_dump() into the Chrome trace event format, which
+# can be loaded by chrome://tracing or https://ui.perfetto.dev.
+#
+# usage: amtrace.py [-o trace.json] [--names FILE] [--mhz MHZ] DUMP
+#
+# DUMP is either the binary file written on native, or the captured serial
+# output of x86-qemu containing the hex-encoded dump between the marker
+# lines (the last dump is used). FILE maps kernel event ids to names, one
+# "id name" per line.
+
+import argparse, json, struct, sys
+
+HEADER = struct.Struct('<8sIIQ')
+RECORD = struct.Struct('<QII3Q')
+
+TRACE_IRQ, TRACE_IRQ_RET, TRACE_YIELD, TRACE_SWITCH = 1, 2, 3, 4
+TRACE_USER = 256
+
+EVENTS = ['null', 'yield', 'syscall', 'pagefault', 'error', 'timer', 'iodev', 'pmi']
+
+def unhex(text):
+    begin = text.rfind('=== AMTRACE BEGIN ===')
+    end = text.find('=== AMTRACE END ===', begin)
+    if begin < 0 or end < 0:
+        sys.exit('amtrace: no trace dump found')
+    body = text[text.index('\n', begin) + 1:end]
+    return bytes.fromhex(''.join(body.split()))
+
+def load(path):
+    data = open(path, 'rb').read()
+    if not data.startswith(b'AMTRACE\0'):
+        data = unhex(data.decode('latin-1'))
+    magic, version, ncpu, ts_hz = HEADER.unpack_from(data)
+    if magic != b'AMTRACE\0' or version != 1:
+        sys.exit('amtrace: bad dump header')
+    recs = [RECORD.unpack_from(data, off)
+            for off in range(HEADER.size, len(data) - RECORD.size + 1, RECORD.size)]
+    return ncpu, ts_hz, [r for r in recs if r[1] != 0]
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument('dump')
+    ap.add_argument('-o', '--output', default='-')
+    ap.add_argument('--names', help='file of "id name" lines for kernel events')
+    ap.add_argument('--mhz', type=float, help='override the timestamp frequency')
+    args = ap.parse_args()
+
+    ncpu, ts_hz, recs = load(args.dump)
+    if args.mhz: ts_hz = args.mhz * 1e6
+    names = {}
+    if args.names:
+        for line in open(args.names):
+            f = line.split(None, 1)
+            if len(f) == 2: names[int(f[0], 0)] = f[1].strip()
+
+    recs.sort(key=lambda r: r[0])
+    t0 = recs[0][0] if recs else 0
+    us = lambda ts: (ts - t0) * 1e6 / ts_hz
+
+    out = []
+    for cpu in range(ncpu):
+        out.append({'ph': 'M', 'name': 'thread_name', 'pid': 0, 'tid': cpu * 2,
+                    'args': {'name': 'CPU #%d' % cpu}})
+        out.append({'ph': 'M', 'name': 'thread_name', 'pid': 0, 'tid': cpu * 2 + 1,
+                    'args': {'name': 'CPU #%d contexts' % cpu}})
+
+    running = {} # cpu -> (context, since)
+    def run(cpu, ctx, ts):
+        prev = running.get(cpu)
+        if prev and prev[0] == ctx: return
+        if prev:
+            out.append({'ph': 'X', 'name': 'ctx %#x' % prev[0], 'pid': 0, 'tid': cpu * 2 + 1,
+                        'ts': us(prev[1]), 'dur': us(ts) - us(prev[1])})
+        running[cpu] = (ctx, ts)
+
+    for ts, id, cpu, a0, a1, a2 in recs:
+        ev = {'pid': 0, 'tid': cpu * 2, 'ts': us(ts)}
+        if id == TRACE_IRQ:
+            name = EVENTS[a0] if a0 < len(EVENTS) else 'event %d' % a0
+            ev.update(ph='B', name=name, args={'cause': a1, 'pc': '%#x' % a2})
+        elif id == TRACE_IRQ_RET:
+            ev.update(ph='E', args={'context': '%#x' % a1})
+        elif id == TRACE_YIELD:
+            ev.update(ph='i', s='t', name='yield()', args={'caller': '%#x' % a0})
+        elif id == TRACE_SWITCH:
+            run(cpu, a0, ts)
+            continue
+        else:
+            name = names.get(id, 'event %d' % id if id < TRACE_USER else 'user %d' % (id - TRACE_USER))
+            ev.update(ph='i', s='t', name=name, args={'arg0': a0, 'arg1': a1, 'arg2': a2})
+        out.append(ev)
+    for cpu in list(running):
+        run(cpu, None, recs[-1][0])
+
+    f = sys.stdout if args.output == '-' else open(args.output, 'w')
+    json.dump({'traceEvents': out, 'displayTimeUnit': 'ns'}, f)
+    f.write('\n')
+
+if __name__ == '__main__':
+    main()
@@ -4,6 +4,9 @@ AM_SRCS := native/trm.c \
            native/trap.S \
            native/vme.c \
            native/mpe.c \
+           native/trace.c \
+           native/prof.c \
+           native/boottime.c \
            native/platform.c \
            native/ioe/input.c \
            native/ioe/timer.c \
@@ -16,7 +19,7 @@ ASFLAGS += -fpie -pie
 
 image:
 	@echo + LD "->" $(IMAGE_REL)
-	@g++ -pie -o $(IMAGE) -Wl,--whole-archive $(LINKAGE) -Wl,-no-whole-archive -lSDL2 -ldl
+	@g++ -pie -o $(IMAGE) -Wl,--whole-archive $(LINKAGE) -Wl,-no-whole-archive -lSDL2 -ldl -lpthread -lrt
 
 run: image
 	$(IMAGE)
@@ -7,7 +7,10 @@ AM_SRCS := x86/qemu/start64.S \
            x86/qemu/cte.c \
            x86/qemu/ioe.c \
            x86/qemu/vme.c \
-           x86/qemu/mpe.c
+           x86/qemu/mpe.c \
+           x86/qemu/trace.c \
+           x86/qemu/prof.c \
+           x86/qemu/boottime.c
 
 run: build-arg
 	@qemu-system-x86_64 $(QEMU_FLAGS)
@@ -0,0 +1,33 @@
+#ifndef BENCH_H__
+#define BENCH_H__
+
+#include <am.h>
+#include <amdev.h>
+#include <klib.h>
+#include <klib-macros.h>
+
+// Each benchmark runs @fn(n) with n doubled until it takes at least
+// MIN_US, and prints one line per result (see bench_report())
+#define MIN_US 100000
+
+// the most CPUs of any architecture (native)
+#define MAX_CPUS 16
+
+typedef void (*bench_fn_t)(uint32_t n);
+
+uint64_t uptime();
+void bench_run(const char *name, bench_fn_t fn, uint32_t bytes_per_op);
+void bench_report(const char *name, uint32_t ops, uint64_t us, uint32_t bytes_per_op);
+void bench_put(const char *s);
+void bench_putu(uint64_t x);
+
+extern uint32_t bench_ticks[MAX_CPUS]; // timer interrupts taken by each CPU
+
+void bench_cte_init();
+void bench_cte();
+void bench_vme();
+void bench_ioe();
+void bench_klib();
+void bench_mpe();
+
+#endif
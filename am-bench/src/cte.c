@@ -0,0 +1,65 @@
+#include <bench.h>
+
+// yield() with a handler that returns the trapped context measures a trap
+// round trip; with a handler that returns a peer kernel context spinning on
+// yield(), each yield() of the benchmark makes two context switches. The
+// handler also counts the timer ticks of each CPU for the mpe group.
+
+static bool switching = false;
+static Context *peer;
+static uint8_t peer_stack[8192];
+uint32_t bench_ticks[MAX_CPUS];
+
+static Context *on_event(Event ev, Context *c) {
+  if (ev.event == EVENT_IRQ_TIMER) {
+    bench_ticks[cpu_current()]++;
+  }
+  if (ev.event == EVENT_YIELD && switching) {
+    Context *next = peer;
+    peer = c;
+    return next;
+  }
+  return c;
+}
+
+static void peer_entry(void *arg) {
+  while (1) yield();
+}
+
+static void yield_n(uint32_t n) {
+  for (uint32_t i = 0; i < n; i++) yield();
+}
+
+static void switch_n(uint32_t n) {
+  switching = true;
+  yield_n(n);
+  switching = false;
+}
+
+// Also called by the mpe group, before other CPUs start
+void bench_cte_init() {
+  static bool done = false;
+  if (!done) {
+    cte_init(on_event);
+    iset(false);
+    done = true;
+  }
+}
+
+void bench_cte() {
+  bench_cte_init();
+  peer = kcontext((Area) { peer_stack, peer_stack + sizeof(peer_stack) }, peer_entry, NULL);
+
+  bench_run("cte.yield", yield_n, 0);
+
+  // report per switch, i.e., half a ping-pong
+  uint32_t n = 1;
+  uint64_t us;
+  switch_n(1);
+  for (; ; n *= 2) {
+    uint64_t t0 = uptime();
+    switch_n(n);
+    if ((us = uptime() - t0) >= MIN_US) break;
+  }
+  bench_report("cte.switch", n * 2, us, 0);
+}
@@ -0,0 +1,70 @@
+#include <bench.h>
+
+// Dispatch cost of ioe_read()/ioe_write() for registers which every
+// architecture implements and which are cheap on the device side
+
+static int reg;
+static union {
+  uint64_t raw[16]; // large enough for any register
+  AM_GPU_FBDRAW_T fbdraw;
+} buf;
+
+static void read_n(uint32_t n) {
+  for (uint32_t i = 0; i < n; i++) ioe_read(reg, &buf);
+}
+
+static void write_n(uint32_t n) {
+  for (uint32_t i = 0; i < n; i++) ioe_write(reg, &buf);
+}
+
+// NR_ROW rows of ROW_W pixels, one below the other and from one pixel
+// buffer: drawn one by one, or by ioe_batch(), which the backend merges
+// into a single ROW_W x NR_ROW draw. Both are reported per row.
+#define NR_ROW 16
+#define ROW_W  128
+static uint32_t pixels[NR_ROW * ROW_W];
+static AM_GPU_FBDRAW_T rows[NR_ROW];
+static IOEOp ops[NR_ROW];
+
+static void rows_n(uint32_t n) {
+  for (uint32_t i = 0; i < n; i++) ioe_write(AM_GPU_FBDRAW, &rows[i % NR_ROW]);
+}
+
+static void batch_n(uint32_t n) {
+  for (uint32_t i = 0; i < n; i += NR_ROW) ioe_batch(ops, NR_ROW);
+}
+
+#define READ(name) { AM_##name, "ioe.read." #name }
+
+static const struct {
+  int reg;
+  const char *name;
+} regs[] = {
+  READ(TIMER_CONFIG), READ(TIMER_UPTIME), READ(TIMER_RTC),
+  READ(INPUT_CONFIG), READ(INPUT_KEYBRD),
+  READ(GPU_CONFIG), READ(GPU_STATUS),
+  READ(UART_CONFIG), READ(AUDIO_CONFIG), READ(DISK_CONFIG),
+  READ(NET_CONFIG), READ(PMU_CONFIG),
+};
+
+void bench_ioe() {
+  for (int i = 0; i < LENGTH(regs); i++) {
+    reg = regs[i].reg;
+    bench_run(regs[i].name, read_n, 0);
+  }
+
+  // an empty rectangle
+  reg = AM_GPU_FBDRAW;
+  buf.fbdraw = (AM_GPU_FBDRAW_T) { .w = 0, .h = 0, .sync = false };
+  bench_run("ioe.write.GPU_FBDRAW", write_n, 0);
+
+  for (int i = 0; i < NR_ROW * ROW_W; i++) pixels[i] = i * 0x010203;
+  for (int i = 0; i < NR_ROW; i++) {
+    rows[i] = (AM_GPU_FBDRAW_T) {
+      .y = i, .w = ROW_W, .h = 1, .pixels = &pixels[i * ROW_W], .sync = false,
+    };
+    ops[i] = (IOEOp) { AM_GPU_FBDRAW, &rows[i] };
+  }
+  bench_run("ioe.rows.GPU_FBDRAW", rows_n, ROW_W * sizeof(uint32_t));
+  bench_run("ioe.batch.GPU_FBDRAW", batch_n, ROW_W * sizeof(uint32_t));
+}
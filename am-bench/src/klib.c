@@ -0,0 +1,38 @@
+#include <bench.h>
+
+#define BLK 4096
+
+static char src[BLK + 64], dst[BLK + 64], str[BLK];
+static volatile int sink;
+
+static void memcpy_n(uint32_t n)  { for (uint32_t i = 0; i < n; i++) memcpy(dst, src, BLK); }
+static void memcpy_u(uint32_t n)  { for (uint32_t i = 0; i < n; i++) memcpy(dst + 1, src + 3, BLK); }
+static void memmove_n(uint32_t n) { for (uint32_t i = 0; i < n; i++) memmove(dst + 8, dst, BLK); }
+static void memset_n(uint32_t n)  { for (uint32_t i = 0; i < n; i++) memset(dst, i, BLK); }
+static void memcmp_n(uint32_t n)  { for (uint32_t i = 0; i < n; i++) sink = memcmp(dst, src, BLK); }
+static void strlen_n(uint32_t n)  { for (uint32_t i = 0; i < n; i++) sink = strlen(str); }
+static void strcmp_n(uint32_t n)  { for (uint32_t i = 0; i < n; i++) sink = strcmp(str, dst); }
+
+static void sprintf_n(uint32_t n) {
+  char buf[128];
+  for (uint32_t i = 0; i < n; i++) {
+    sink = sprintf(buf, "%d %s %x %c|%8d|%-5s|", i, "abc", i, 'z', -(int)i, "de");
+  }
+}
+
+void bench_klib() {
+  for (int i = 0; i < sizeof(src); i++) src[i] = i;
+  for (int i = 0; i < sizeof(str) - 1; i++) str[i] = 'a' + i % 26;
+  str[sizeof(str) - 1] = '\0';
+
+  bench_run("klib.memcpy-4k", memcpy_n, BLK);
+  bench_run("klib.memcpy-4k-unaligned", memcpy_u, BLK);
+  bench_run("klib.memmove-4k-overlap", memmove_n, BLK);
+  bench_run("klib.memset-4k", memset_n, BLK);
+  memcpy(dst, src, BLK);
+  bench_run("klib.memcmp-4k", memcmp_n, BLK);
+  memcpy(dst, str, BLK);
+  bench_run("klib.strlen-4k", strlen_n, BLK);
+  bench_run("klib.strcmp-4k", strcmp_n, BLK);
+  bench_run("klib.sprintf", sprintf_n, 0);
+}
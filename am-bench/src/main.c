@@ -0,0 +1,87 @@
+#include <bench.h>
+
+// Results are printed one per line, as space-separated key=value pairs
+// behind a "bench" tag, so that the runs of two commits can be diffed or
+// joined by name:
+//
+//   bench arch=x86_64-qemu cpus=2
+//   bench name=cte.yield ops=131072 ns/op=1203.4
+//   bench name=klib.memcpy-4k ops=65536 ns/op=402.1 MB/s=10186
+//
+// "make run mainargs=cte,ioe" runs only the given groups; all by default.
+// The klib group needs a klib with the string and stdio functions.
+
+static const char *args;
+
+static bool selected(const char *group) {
+  if (!args || !*args) return true;
+  for (const char *p = args; *p; ) {
+    const char *g = group;
+    while (*g && *p == *g) { p++; g++; }
+    if (*g == '\0' && (*p == ',' || *p == '\0')) return true;
+    while (*p && *p != ',') p++;
+    if (*p == ',') p++;
+  }
+  return false;
+}
+
+void bench_put(const char *s) {
+  for (; *s; s++) putch(*s);
+}
+
+void bench_putu(uint64_t x) {
+  char buf[24], *p = buf + sizeof(buf) - 1;
+  *p = '\0';
+  do { *--p = '0' + x % 10; x /= 10; } while (x);
+  bench_put(p);
+}
+
+uint64_t uptime() {
+  return io_read(AM_TIMER_UPTIME).us;
+}
+
+void bench_report(const char *name, uint32_t ops, uint64_t us, uint32_t bytes_per_op) {
+  bench_put("bench name="); bench_put(name);
+  bench_put(" ops=");   bench_putu(ops);
+  if (ops) {
+    uint64_t ns10 = us * 10000 / ops; // in 0.1 ns
+    bench_put(" ns/op="); bench_putu(ns10 / 10);
+    bench_put(".");       bench_putu(ns10 % 10);
+  } else {
+    bench_put(" ns/op=-");
+  }
+  if (bytes_per_op) {
+    // bytes per us is MB/s
+    bench_put(" MB/s="); bench_putu((uint64_t)bytes_per_op * ops / (us ? us : 1));
+  }
+  bench_put("\n");
+}
+
+void bench_run(const char *name, bench_fn_t fn, uint32_t bytes_per_op) {
+  fn(1); // warm up
+  for (uint32_t n = 1; ; n *= 2) {
+    uint64_t t0 = uptime();
+    fn(n);
+    uint64_t us = uptime() - t0;
+    if (us >= MIN_US || n == (1u << 31)) {
+      bench_report(name, n, us, bytes_per_op);
+      return;
+    }
+  }
+}
+
+int main(const char *mainargs) {
+  args = mainargs;
+  ioe_init();
+
+  bench_put("bench arch=" TOSTRING(__ARCH__) " cpus=");
+  bench_putu(cpu_count());
+  bench_put("\n");
+
+  if (selected("cte"))  bench_cte();
+  if (selected("ioe"))  bench_ioe();
+  if (selected("vme"))  bench_vme();
+  if (selected("klib")) bench_klib();
+  if (selected("mpe"))  bench_mpe(); // does not return
+  halt(0);
+}
@@ -0,0 +1,219 @@
+#include <bench.h>
+
+// The cost of finding the running CPU and its per-CPU area, and a single-
+// CPU baseline of atomic_xchg(); then, with all CPUs started:
+//
+// - all CPUs hammer one word with atomic_xchg(), and CPU #0 times the whole;
+// - a test-and-set spinlock, a ticket lock and an MCS lock guard a counter
+//   on 1, 2, 4, ... CPUs (up to all of them) for MIN_US each. A result is
+//   per critical section of all CPUs together, i.e., the inverse of the
+//   lock's throughput;
+// - all CPUs take timer interrupts for TICK_US, and the mean tick period of
+//   each CPU is reported, to be compared with that of the timer (e.g., 1/hz
+//   on native): the ticks should neither stop on nor favor some CPUs.
+
+#define NR_XCHG (1 << 20)
+#define TICK_US 1000000
+
+static int word;
+
+static void xchg_n(uint32_t n) {
+  for (uint32_t i = 0; i < n; i++) atomic_xchg(&word, i);
+}
+
+static void current_n(uint32_t n) {
+  for (uint32_t i = 0; i < n; i++) word += cpu_current();
+}
+
+static void data_n(uint32_t n) {
+  for (uint32_t i = 0; i < n; i++) ((int *)cpu_data())[0]++;
+}
+
+// A barrier of all CPUs, reusable as the last one to arrive moves on the
+// generation
+static int bar_count, bar_gen;
+
+static void barrier() {
+  int gen = atomic_load_acquire(&bar_gen);
+  if (atomic_fetchadd(&bar_count, 1) == cpu_count() - 1) {
+    atomic_store_release(&bar_count, 0);
+    atomic_store_release(&bar_gen, gen + 1);
+  } else {
+    while (atomic_load_acquire(&bar_gen) == gen) ;
+  }
+}
+
+// Locks
+
+typedef struct {
+  const char *name;
+  void (*lock)(int cpu);
+  void (*unlock)(int cpu);
+} Lock;
+
+static int spin;
+
+static void spin_lock(int cpu) {
+  while (atomic_xchg(&spin, 1)) {
+    while (atomic_load_acquire(&spin)) ;
+  }
+}
+
+static void spin_unlock(int cpu) {
+  atomic_store_release(&spin, 0);
+}
+
+static int ticket_next, ticket_owner;
+
+static void ticket_lock(int cpu) {
+  int me = atomic_fetchadd(&ticket_next, 1);
+  while (atomic_load_acquire(&ticket_owner) != me) ;
+}
+
+static void ticket_unlock(int cpu) {
+  atomic_store_release(&ticket_owner, ticket_owner + 1);
+}
+
+// The queue links CPUs by number + 1 (0: none), as the atomics are on int
+static struct {
+  int next, locked;
+} mcs_node[MAX_CPUS];
+static int mcs_tail;
+
+static void mcs_lock(int cpu) {
+  mcs_node[cpu].next = 0;
+  mcs_node[cpu].locked = 1;
+  int prev = atomic_xchg(&mcs_tail, cpu + 1);
+  if (prev) {
+    atomic_store_release(&mcs_node[prev - 1].next, cpu + 1);
+    while (atomic_load_acquire(&mcs_node[cpu].locked)) ;
+  }
+}
+
+static void mcs_unlock(int cpu) {
+  int next = atomic_load_acquire(&mcs_node[cpu].next);
+  if (!next) {
+    if (atomic_cmpxchg(&mcs_tail, cpu + 1, 0) == cpu + 1) return;
+    while (!(next = atomic_load_acquire(&mcs_node[cpu].next))) ;
+  }
+  atomic_store_release(&mcs_node[next - 1].locked, 0);
+}
+
+static const Lock locks[] = {
+  { "spinlock",   spin_lock,   spin_unlock   },
+  { "ticketlock", ticket_lock, ticket_unlock },
+  { "mcslock",    mcs_lock,    mcs_unlock    },
+};
+
+static int stop, counter;
+static uint32_t acquired[MAX_CPUS];
+
+// @name: "mpe.@what-@prefix@n@suffix"
+static void name_n(char *name, const char *what, const char *prefix, int n,
+                   const char *suffix) {
+  char *p = name;
+  for (const char *s = "mpe."; *s; ) *p++ = *s++;
+  for (const char *s = what; *s; ) *p++ = *s++;
+  *p++ = '-';
+  for (const char *s = prefix; *s; ) *p++ = *s++;
+  if (n >= 10) *p++ = '0' + n / 10;
+  *p++ = '0' + n % 10;
+  for (const char *s = suffix; *s; ) *p++ = *s++;
+  *p = '\0';
+}
+
+// Runs on CPUs [0, @ncpu) until CPU #0 has spent MIN_US in the loop
+static void contend(const Lock *l, int ncpu) {
+  int cpu = cpu_current();
+  uint64_t t0 = 0;
+  if (cpu == 0) {
+    stop = counter = 0;
+    t0 = uptime();
+  }
+  barrier();
+  if (cpu < ncpu) {
+    uint32_t n = 0;
+    while (!atomic_load_acquire(&stop)) {
+      l->lock(cpu);
+      counter++;
+      l->unlock(cpu);
+      n++;
+      if (cpu == 0 && n % 16 == 0 && uptime() - t0 >= MIN_US) {
+        atomic_store_release(&stop, 1);
+      }
+    }
+    acquired[cpu] = n;
+  }
+  barrier();
+  if (cpu == 0) {
+    uint64_t us = uptime() - t0;
+    uint32_t total = 0;
+    for (int i = 0; i < ncpu; i++) total += acquired[i];
+    panic_on(total != (uint32_t)counter, "lock is not mutually exclusive");
+
+    char name[32];
+    name_n(name, l->name, "", ncpu, "cpu");
+    bench_report(name, total, us, 0);
+  }
+}
+
+static void ticks() {
+  int cpu = cpu_current();
+  if (cpu == 0) stop = 0;
+  barrier();
+  uint64_t t0 = (cpu == 0 ? uptime() : 0), us = 0;
+  uint32_t base = bench_ticks[cpu];
+  iset(true);
+  if (cpu == 0) {
+    // spin mostly outside uptime(), since native drops the ticks which
+    // arrive in shared libraries
+    while ((us = uptime() - t0) < TICK_US) {
+      for (volatile int i = 0; i < 65536; i++) ;
+    }
+    atomic_store_release(&stop, 1);
+  } else {
+    while (!atomic_load_acquire(&stop)) ;
+  }
+  iset(false);
+  acquired[cpu] = bench_ticks[cpu] - base;
+  barrier();
+  if (cpu == 0) {
+    for (int i = 0; i < cpu_count(); i++) {
+      char name[32];
+      name_n(name, "ticks", "cpu", i, "");
+      bench_report(name, acquired[i], us, 0);
+    }
+  }
+}
+
+static void mp_entry() {
+  barrier();
+  uint64_t t0 = (cpu_current() == 0 ? uptime() : 0);
+  xchg_n(NR_XCHG);
+  barrier();
+  if (cpu_current() == 0) {
+    // per operation seen by one CPU, all CPUs contending
+    bench_report("mpe.xchg-contended", NR_XCHG, uptime() - t0, 0);
+  }
+
+  int ncpu = cpu_count();
+  for (int i = 0; i < LENGTH(locks); i++) {
+    for (int n = 1; ; n *= 2) {
+      if (n > ncpu) n = ncpu;
+      contend(&locks[i], n);
+      if (n == ncpu) break;
+    }
+  }
+  ticks();
+
+  if (cpu_current() == 0) halt(0);
+  while (1) ;
+}
+
+void bench_mpe() {
+  bench_cte_init();
+  bench_run("mpe.cpu_current", current_n, 0);
+  bench_run("mpe.cpu_data", data_n, 0);
+  bench_run("mpe.xchg-uncontended", xchg_n, 0);
+  mpe_init(mp_entry);
+}
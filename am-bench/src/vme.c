@@ -0,0 +1,70 @@
+#include <bench.h>
+
+// NR_AS address spaces are created, NR_PAGE pages are mapped into each (and
+// on x86, unmapped again), and then they are all torn down, each step timed
+// as a whole. Native never frees pages and leaks the mapping table of each
+// address space, hence the few address spaces there.
+
+#define NR_PAGE 256
+#ifdef __ARCH_NATIVE
+#define NR_AS   8
+#else
+#define NR_AS   256
+#endif
+
+static void *free_list;
+static uint8_t *pg_top;
+
+static void *pgalloc(int size) {
+  void *p = free_list;
+  if (p) {
+    free_list = *(void **)p;
+  } else {
+    pg_top = (uint8_t *)ROUNDUP(pg_top, size);
+    p = pg_top;
+    pg_top += size;
+    panic_on(pg_top > (uint8_t *)heap.end, "out of memory");
+  }
+  return p;
+}
+
+static void pgfree(void *p) {
+  *(void **)p = free_list;
+  free_list = p;
+}
+
+static AddrSpace as[NR_AS];
+
+static void map_all(void *pa, int prot) {
+  for (int k = 0; k < NR_AS; k++) {
+    for (int i = 0; i < NR_PAGE; i++) {
+      map(&as[k], as[k].area.start + i * as[k].pgsize, pa, prot);
+    }
+  }
+}
+
+void bench_vme() {
+  pg_top = heap.start;
+  vme_init(pgalloc, pgfree);
+
+  uint64_t t0 = uptime();
+  for (int k = 0; k < NR_AS; k++) protect(&as[k]);
+  uint64_t t1 = uptime();
+  void *pa = pgalloc(as[0].pgsize);
+  map_all(pa, MMAP_READ | MMAP_WRITE);
+  uint64_t t2 = uptime();
+#ifndef __ARCH_NATIVE
+  map_all(pa, MMAP_NONE);
+#endif
+  uint64_t t3 = uptime();
+  for (int k = 0; k < NR_AS; k++) unprotect(&as[k]);
+  uint64_t t4 = uptime();
+  pgfree(pa);
+
+  bench_report("vme.protect", NR_AS, t1 - t0, 0);
+  bench_report("vme.map", NR_AS * NR_PAGE, t2 - t1, 0);
+#ifndef __ARCH_NATIVE
+  bench_report("vme.unmap", NR_AS * NR_PAGE, t3 - t2, 0);
+#endif
+  bench_report("vme.unprotect", NR_AS, t4 - t3, 0);
+}
@@ -0,0 +1,70 @@
+#!/bin/sh
+# Generates a synthetic /proc of N processes (default 100000) under DIR, to
+# time pstree on a tree of that size. Pid 1 is init and every other pid i
+# gets a random parent below i, so the tree is a random recursive one of
+# depth about ln(N). Every 50th process has THREADS (default 4) more
+# threads under task/. Only what pstree reads is there: <pid>/stat with
+# fields up to starttime, and task/<tid>/stat and comm.
+#
+#   ./gen-proc.sh /tmp/proc 100000
+#   CFLAGS='-DPROC_ROOT="\"/tmp/proc\""' make pstree-64
+#   time ./pstree-64 > /dev/null
+#
+# Use a tmpfs for DIR, or the timing is the disk's. SEED (default 1) makes
+# the parents reproducible.
+
+set -e
+
+if [ $# -lt 1 ]; then
+  echo "usage: $0 DIR [N] [THREADS]" >&2
+  exit 1
+fi
+dir=$1
+n=${2:-100000}
+threads=${3:-4}
+seed=${SEED:-1}
+
+mkdir -p "$dir"
+awk -v dir="$dir" -v n="$n" -v threads="$threads" -v seed="$seed" '
+function stat(path, pid, name, ppid, nr_threads) {
+  # pid (comm) state ppid pgrp session tty_nr tpgid flags minflt cminflt
+  # majflt cmajflt utime stime cutime cstime priority nice num_threads
+  # itrealvalue starttime
+  printf "%d (%s) S %d %d %d 0 -1 4194560 0 0 0 0 0 0 0 0 20 0 %d 0 %d\n",
+    pid, name, ppid, pid, pid, nr_threads, pid + 100 > path
+  close(path)
+}
+
+function comm(path, name) {
+  print name > path
+  close(path)
+}
+
+BEGIN {
+  srand(seed)
+  nr_names = split("systemd|bash|sshd|nginx|postgres|python3|kworker/0:1|" \
+                   "Web Content|(sd-pam)|containerd-shim", names, "|")
+  tid = n
+  mkdir = "xargs mkdir -p"
+  for (pid = 1; pid <= n; pid++) {
+    ppid[pid] = (pid == 1 ? 0 : 1 + int(rand() * (pid - 1)))
+    name[pid] = (pid == 1 ? "init" : names[1 + int(rand() * nr_names)])
+    nr[pid] = (pid % 50 == 0 ? threads : 0)
+    print dir "/" pid "/task/" pid | mkdir
+    for (i = 0; i < nr[pid]; i++) print dir "/" pid "/task/" (tid + i + 1) | mkdir
+    tid += nr[pid]
+  }
+  close(mkdir)
+
+  tid = n
+  for (pid = 1; pid <= n; pid++) {
+    stat(dir "/" pid "/stat", pid, name[pid], ppid[pid], nr[pid] + 1)
+    stat(dir "/" pid "/task/" pid "/stat", pid, name[pid], ppid[pid], nr[pid] + 1)
+    comm(dir "/" pid "/task/" pid "/comm", name[pid])
+    for (i = 0; i < nr[pid]; i++) {
+      t = dir "/" pid "/task/" (++tid)
+      stat(t "/stat", tid, name[pid], ppid[pid], nr[pid] + 1)
+      comm(t "/comm", name[pid] ":" i)
+    }
+  }
+}'
@@ -1,248 +1,1375 @@
+#define _GNU_SOURCE
 #include <assert.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <langinfo.h>
+#include <limits.h>
+#include <locale.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 
+// may be overridden to scan a synthetic tree, e.g. for benchmarking
+#ifndef PROC_ROOT
+#define PROC_ROOT "/proc"
+#endif
+
+// getdents64(2) buffer; one call returns about a thousand pid entries
+#define DENTS_BUFSZ (32 * 1024)
+// enough for the fields we parse: pid, comm (at most 64 bytes), ppid and
+// starttime (the 22nd)
+#define STAT_BUFSZ 512
+// output is written in chunks of this size
+#define OUT_BUFSZ (64 * 1024)
+
+// How threads are collected (-t and --thread-names)
+enum {
+  THREADS_NONE,
+  THREADS_COUNT, // one entry per process standing for all of its threads
+  THREADS_EACH,  // one entry per thread, named after the process
+  THREADS_NAMED, // one entry per thread, with the thread's own name
+};
+
+// Snapshot files (--dump and --load)
+#define SNAP_MAGIC "PSTSNAP"
+#define SNAP_VERSION 1
+#define SNAP_BYTE_ORDER 0x01020304
+
+// upper bound of -j
+#define MAX_THREADS 256
+// --watch re-reads every pid once in this many refreshes, to pick up names
+// changed by exec(2)
+#define WATCH_RESCAN 50
+
+// The header of a snapshot file. It is followed by the Process records
+// at procs_off and the string arena at names_off, so a loaded table can
+// use both in place. Integers are in the byte order of the host that
+// wrote the file, which byte_order tells.
+typedef struct SnapHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t proc_size; // sizeof(Process)
+  uint32_t nr;
+  uint64_t procs_off;
+  uint64_t names_off;
+  uint64_t names_len;
+} SnapHeader;
+
+struct linux_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+// Process is also the record of snapshot files (--dump): a change to it
+// needs a new SNAP_VERSION.
 typedef struct Process {
-  char name[NAME_MAX];
   int pid;
   int ppid;
-  struct ChildNode *children;
+  int name;    // offset of the name in the string arena
+  int threads; // 0 for processes; for threads, how many this entry stands for
+  unsigned long long starttime; // tells a reused pid from the process before
 } Process;
 
-typedef struct ChildNode {
-  Process *val;
-  struct ChildNode *next;
-} ChildNode, *Children;
+// The process table: all processes in one growable array, and every
+// distinct name stored once in a string arena. A table loaded from a
+// snapshot points into the read-only mapping of the file instead.
+typedef struct Table {
+  Process *procs;
+  int nr, cap;
+  char *names;
+  int names_len, names_cap;
+  int *name_hash; // open addressing, arena offset + 1 (0: empty slot)
+  int name_hash_cap, nr_names;
+  void *map; // the snapshot mapping, if loaded
+  size_t map_len;
+} Table;
 
-typedef struct ListNode {
+// The tree over a table: the children of procs[i] are the processes
+// children[first_child[i]] ... children[first_child[i] + nr_children[i] - 1].
+typedef struct Tree {
+  int *index; // pid -> process index + 1 (0: no such process)
+  int pid_max;
+  int *first_child;
+  int *nr_children;
+  int *children;
+  char *sorted;
+  int *repeat; // size of the group a child starts when printed, 0 if none
+} Tree;
 
-  Process val;
-  struct ListNode *next;
-} ListNode, *List;
+void *xrealloc(void *ptr, size_t size) {
+  ptr = realloc(ptr, size);
+  if (ptr == NULL) {
+    fprintf(stderr, "error: malloc fault");
+    exit(0);
+  }
+  return ptr;
+}
 
-void free_children(Children c) {
-  ChildNode *cur = c;
-  while (cur != NULL) {
-    ChildNode *next = cur->next;
-    free(cur);
-    cur = next;
+void *xcalloc(size_t nmemb, size_t size) {
+  void *ptr = calloc(nmemb, size);
+  if (ptr == NULL) {
+    fprintf(stderr, "error: malloc fault");
+    exit(0);
   }
+  return ptr;
 }
 
-void free_list(List l) {
-  ListNode *cur = l->next;
-  while (cur != NULL) {
-    ListNode *next = cur->next;
-    free_children(cur->val.children);
-    free(cur);
-    cur = next;
+void free_table(Table *t) {
+  if (t->map != NULL) {
+    munmap(t->map, t->map_len);
+    memset(t, 0, sizeof(*t));
+    return;
   }
+  free(t->procs);
+  free(t->names);
+  free(t->name_hash);
+  memset(t, 0, sizeof(*t));
 }
 
-void get_processes(List l) {
-  assert(l != NULL);
-  DIR *dir;
-  struct dirent *entry;
-  char path[PATH_MAX];
-  dir = opendir("/proc");
-  if (!dir) {
-    fprintf(stderr, "error: open dir /proc");
-    exit(0);
+void free_tree(Tree *tr) {
+  free(tr->index);
+  free(tr->first_child);
+  free(tr->nr_children);
+  free(tr->children);
+  free(tr->sorted);
+  free(tr->repeat);
+  memset(tr, 0, sizeof(*tr));
+}
+
+static inline const char *name_of(const Table *t, const Process *p) {
+  return t->names + p->name;
+}
+
+unsigned hash_name(const char *name, int len) {
+  unsigned h = 2166136261u; // FNV-1a
+  for (int i = 0; i < len; i++) {
+    h = (h ^ (unsigned char)name[i]) * 16777619u;
+  }
+  return h;
+}
+
+void rehash_names(Table *t) {
+  int cap = t->name_hash_cap ? t->name_hash_cap * 2 : 1024;
+  int *hash = (int *)xcalloc(cap, sizeof(int));
+  for (int i = 0; i < t->name_hash_cap; i++) {
+    int off = t->name_hash[i] - 1;
+    if (off >= 0) {
+      const char *name = t->names + off;
+      unsigned h = hash_name(name, strlen(name)) & (cap - 1);
+      while (hash[h] != 0) {
+        h = (h + 1) & (cap - 1);
+      }
+      hash[h] = off + 1;
+    }
+  }
+  free(t->name_hash);
+  t->name_hash = hash;
+  t->name_hash_cap = cap;
+}
+
+// Returns the arena offset of @name (of @len bytes), adding it if new.
+int intern_name(Table *t, const char *name, int len) {
+  if ((t->nr_names + 1) * 2 > t->name_hash_cap) {
+    rehash_names(t);
+  }
+  unsigned h = hash_name(name, len) & (t->name_hash_cap - 1);
+  while (t->name_hash[h] != 0) {
+    const char *s = t->names + t->name_hash[h] - 1;
+    if (strncmp(s, name, len) == 0 && s[len] == '\0') {
+      return t->name_hash[h] - 1;
+    }
+    h = (h + 1) & (t->name_hash_cap - 1);
+  }
+
+  if (t->names_len + len + 1 > t->names_cap) {
+    t->names_cap = t->names_cap ? t->names_cap * 2 : 4096;
+    while (t->names_len + len + 1 > t->names_cap) {
+      t->names_cap *= 2;
+    }
+    t->names = (char *)xrealloc(t->names, t->names_cap);
   }
-  ListNode *cur = l;
+  int off = t->names_len;
+  memcpy(t->names + off, name, len);
+  t->names[off + len] = '\0';
+  t->names_len += len + 1;
+  t->name_hash[h] = off + 1;
+  t->nr_names++;
+  return off;
+}
 
-  while ((entry = readdir(dir)) != NULL) {
-    if (entry->d_type == DT_DIR) {
-      char *endptr;
-      long pid = strtol(entry->d_name, &endptr, 10);
-      if (*endptr != '\0') {
+void add_process(Table *t, int pid, int ppid, const char *name, int len) {
+  if (t->nr == t->cap) {
+    t->cap = t->cap ? t->cap * 2 : 1024;
+    t->procs = (Process *)xrealloc(t->procs, t->cap * sizeof(Process));
+  }
+  Process *p = &t->procs[t->nr++];
+  p->pid = pid;
+  p->ppid = ppid;
+  p->name = intern_name(t, name, len);
+  p->threads = 0;
+  p->starttime = 0;
+}
+
+// Adds @count threads of process @pid as one entry named "{@name}".
+void add_thread(Table *t, int tid, int pid, const char *name, int len,
+                int count) {
+  char braced[NAME_MAX + 2];
+  braced[0] = '{';
+  memcpy(braced + 1, name, len);
+  braced[len + 1] = '}';
+  add_process(t, tid, pid, braced, len + 2);
+  t->procs[t->nr - 1].threads = count;
+}
+
+// The fields of /proc/<pid>/stat that pstree uses
+typedef struct Stat {
+  int pid;
+  int ppid;
+  char *name; // not NUL-terminated
+  int len;
+  unsigned long long starttime;
+} Stat;
+
+// Parses the @n bytes of a /proc/<pid>/stat read into @buf, which has room
+// for a terminating NUL. comm may contain spaces and parentheses, so it
+// ends at the last ')'; no later field can contain one.
+int parse_stat(char *buf, int n, Stat *st) {
+  buf[n] = '\0';
+  char *open = memchr(buf, '(', n);
+  char *close = memrchr(buf, ')', n);
+  if (open == NULL || close == NULL || close < open || close + 4 >= buf + n) {
+    return -1;
+  }
+  st->pid = atoi(buf);
+  st->name = open + 1;
+  st->len = close - open - 1;
+  if (st->len > NAME_MAX - 1) {
+    st->len = NAME_MAX - 1;
+  }
+  // ") S ppid ..."
+  char *p = close + 4;
+  st->ppid = strtol(p, &p, 10);
+  for (int field = 4; field < 22 && *p != '\0'; p++) {
+    if (*p == ' ') {
+      field++;
+    }
+  }
+  st->starttime = strtoull(p, NULL, 10);
+  return 0;
+}
+
+// Reads /proc/<@pid>/stat relative to @procfd with a single read(2) into
+// @buf of STAT_BUFSZ bytes, which @st then points into; returns -1 if the
+// process is gone or unparsable.
+int read_stat(int procfd, int pid, char *buf, Stat *st) {
+  char path[32];
+  snprintf(path, sizeof(path), "%d/stat", pid);
+  int fd = openat(procfd, path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    // the process exited after its directory entry was read
+    return -1;
+  }
+  int n = read(fd, buf, STAT_BUFSZ - 1);
+  close(fd);
+  return n > 0 ? parse_stat(buf, n, st) : -1;
+}
+
+// Reads the name of thread @tid from <@tid>/comm relative to the task
+// directory @taskfd into @buf; returns its length, or -1 if it is gone.
+int read_comm(int taskfd, const char *tid, char *buf) {
+  char path[NAME_MAX + 8];
+  snprintf(path, sizeof(path), "%s/comm", tid);
+  int fd = openat(taskfd, path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  int n = read(fd, buf, NAME_MAX - 1);
+  close(fd);
+  if (n > 0 && buf[n - 1] == '\n') {
+    n--;
+  }
+  return n > 0 ? n : -1;
+}
+
+// Adds the threads of process @pid, named @name of @len bytes, other than
+// its main thread. A task directory usually takes a single getdents64(2)
+// into @dents, and nothing else is read unless @mode is THREADS_NAMED, so
+// THREADS_COUNT costs one entry per process however many threads it has.
+void read_threads(Table *t, int procfd, int pid, const char *name, int len,
+                  int mode, char *dents) {
+  char path[32];
+  snprintf(path, sizeof(path), "%d/task", pid);
+  int taskfd = openat(procfd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (taskfd < 0) {
+    return;
+  }
+
+  int count = 0;
+  long n;
+  while ((n = syscall(SYS_getdents64, taskfd, dents, DENTS_BUFSZ)) > 0) {
+    for (long off = 0; off < n;) {
+      struct linux_dirent64 *d = (struct linux_dirent64 *)(dents + off);
+      off += d->d_reclen;
+      if (d->d_name[0] < '1' || d->d_name[0] > '9') {
         continue;
       }
-      snprintf(path, PATH_MAX, "/proc/%ld/stat", pid);
-      FILE *fp = fopen(path, "r");
-      if (fp) {
-        char name[NAME_MAX + 2] = {0};
-        int ppid = 0;
-        fscanf(fp, "%ld %s %*c %d", &pid, name, &ppid);
-        ListNode *t = (ListNode *)calloc(1, sizeof(ListNode));
-        strncpy(t->val.name, name + 1, strlen(name) - 2);
-        if (t == NULL) {
-          fprintf(stderr, "error: malloc fault");
-          free_list(l);
-          exit(0);
-        }
-        t->val.pid = pid;
-        t->val.ppid = ppid;
-        t->val.children = NULL;
-        t->next = NULL;
-
-        cur->next = t;
-        cur = cur->next;
-        fprintf(stderr, "Added process: %s (pid: %d, ppid: %d)\n",
-                cur->val.name, cur->val.pid, cur->val.ppid);
+      int tid = atoi(d->d_name);
+      if (tid == pid) {
+        continue;
+      }
+      if (mode == THREADS_COUNT) {
+        count++;
       } else {
-        fprintf(stderr, "error: open pid: %ld file", pid);
+        char tname[NAME_MAX];
+        int tlen = mode == THREADS_NAMED ? read_comm(taskfd, d->d_name, tname)
+                                         : -1;
+        if (tlen < 0) {
+          add_thread(t, tid, pid, name, len, 1);
+        } else {
+          add_thread(t, tid, pid, tname, tlen, 1);
+        }
       }
-      fclose(fp);
     }
   }
-  closedir(dir);
+  close(taskfd);
+  if (count > 0) {
+    add_thread(t, pid, pid, name, len, count);
+  }
 }
 
-void set_children(List l) {
-  assert(l != NULL);
-  ListNode *cur_i = l->next;
-  while (cur_i != NULL) {
-    ListNode *cur_j = l->next;
-    while (cur_j != NULL) {
-      if (cur_i->val.pid == cur_j->val.ppid) {
-        Children children = (Children)calloc(1, sizeof(ChildNode));
-        if (children == NULL) {
-          fprintf(stderr, "error: malloc fault");
-          free_list(l);
-          exit(0);
+// Adds process @pid, and its threads as told by @mode; returns -1 if the
+// process is gone.
+int read_process(Table *t, int procfd, int pid, int mode, char *dents) {
+  char buf[STAT_BUFSZ];
+  Stat st;
+  if (read_stat(procfd, pid, buf, &st) != 0) {
+    return -1;
+  }
+  add_process(t, st.pid, st.ppid, st.name, st.len);
+  t->procs[t->nr - 1].starttime = st.starttime;
+  if (mode != THREADS_NONE) {
+    read_threads(t, procfd, st.pid, st.name, st.len, mode, dents);
+  }
+  return 0;
+}
+
+// Lists the pid directories under @procfd into *@pids, and their inode
+// numbers into *@inos unless it is NULL; returns the count.
+int list_pids(int procfd, int **pids, uint64_t **inos) {
+  char *dents = (char *)xrealloc(NULL, DENTS_BUFSZ);
+  int nr = 0, cap = 1024;
+  *pids = (int *)xrealloc(NULL, cap * sizeof(int));
+  if (inos) {
+    *inos = (uint64_t *)xrealloc(NULL, cap * sizeof(uint64_t));
+  }
+  long n;
+  while ((n = syscall(SYS_getdents64, procfd, dents, DENTS_BUFSZ)) > 0) {
+    for (long off = 0; off < n;) {
+      struct linux_dirent64 *d = (struct linux_dirent64 *)(dents + off);
+      off += d->d_reclen;
+      if (d->d_type != DT_DIR || d->d_name[0] < '1' || d->d_name[0] > '9') {
+        continue;
+      }
+      if (nr == cap) {
+        cap *= 2;
+        *pids = (int *)xrealloc(*pids, cap * sizeof(int));
+        if (inos) {
+          *inos = (uint64_t *)xrealloc(*inos, cap * sizeof(uint64_t));
         }
-        children->next = cur_i->val.children;
-        children->val = &(cur_j->val);
-        cur_i->val.children = children;
       }
-      cur_j = cur_j->next;
+      if (inos) {
+        (*inos)[nr] = d->d_ino;
+      }
+      (*pids)[nr++] = atoi(d->d_name);
     }
-    cur_i = cur_i->next;
   }
+  if (n < 0) {
+    fprintf(stderr, "error: read dir " PROC_ROOT);
+    exit(0);
+  }
+  free(dents);
+  return nr;
 }
 
-void sort_by_name(Children);
-void sort_by_pid(Children);
-void sort(List l, int numeric_sort_flag) {
-  assert(l != NULL);
-  ListNode *cur = l->next;
-  while (cur != NULL) {
-    if (cur->val.children) {
-      if (numeric_sort_flag) {
-        sort_by_pid(cur->val.children);
-      } else {
-        sort_by_name(cur->val.children);
+// A worker reads a contiguous slice of the pid list into its own table,
+// so that workers share nothing until the batches are merged.
+typedef struct Batch {
+  Table table;
+  int procfd;
+  int mode;
+  const int *pids;
+  int nr_pids;
+} Batch;
+
+void *collect_batch(void *arg) {
+  Batch *b = (Batch *)arg;
+  char *dents = NULL;
+  if (b->mode != THREADS_NONE) {
+    dents = (char *)xrealloc(NULL, DENTS_BUFSZ);
+  }
+  for (int i = 0; i < b->nr_pids; i++) {
+    read_process(&b->table, b->procfd, b->pids[i], b->mode, dents);
+  }
+  free(dents);
+  return NULL;
+}
+
+// Appends the processes of @src to @dst; names are re-interned into the
+// arena of @dst.
+void merge_table(Table *dst, const Table *src) {
+  for (int i = 0; i < src->nr; i++) {
+    const Process *p = &src->procs[i];
+    const char *name = name_of(src, p);
+    add_process(dst, p->pid, p->ppid, name, strlen(name));
+    dst->procs[dst->nr - 1].threads = p->threads;
+    dst->procs[dst->nr - 1].starttime = p->starttime;
+  }
+}
+
+// Collects all processes, and their threads as told by @mode, with
+// @nr_threads threads. Batches are merged in pid-list order, so the table
+// is the same as a serial scan's.
+void get_processes(Table *t, int nr_threads, int mode) {
+  assert(t != NULL && nr_threads >= 1);
+  int procfd = open(PROC_ROOT, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (procfd < 0) {
+    fprintf(stderr, "error: open dir " PROC_ROOT);
+    exit(0);
+  }
+
+  int *pids;
+  int nr_pids = list_pids(procfd, &pids, NULL);
+  if (nr_threads > nr_pids) {
+    nr_threads = nr_pids > 0 ? nr_pids : 1;
+  }
+
+  if (nr_threads == 1) {
+    Batch b = {.table = *t,
+               .procfd = procfd,
+               .mode = mode,
+               .pids = pids,
+               .nr_pids = nr_pids};
+    collect_batch(&b);
+    *t = b.table;
+  } else {
+    Batch *batches = (Batch *)xcalloc(nr_threads, sizeof(Batch));
+    pthread_t *threads = (pthread_t *)xcalloc(nr_threads, sizeof(pthread_t));
+    for (int i = 0; i < nr_threads; i++) {
+      int lo = (long)nr_pids * i / nr_threads;
+      int hi = (long)nr_pids * (i + 1) / nr_threads;
+      batches[i].procfd = procfd;
+      batches[i].mode = mode;
+      batches[i].pids = pids + lo;
+      batches[i].nr_pids = hi - lo;
+      if (pthread_create(&threads[i], NULL, collect_batch, &batches[i]) != 0) {
+        fprintf(stderr, "error: create thread");
+        exit(0);
       }
     }
-    cur = cur->next;
+    for (int i = 0; i < nr_threads; i++) {
+      pthread_join(threads[i], NULL);
+      merge_table(t, &batches[i].table);
+      free_table(&batches[i].table);
+    }
+    free(threads);
+    free(batches);
+  }
+  free(pids);
+  close(procfd);
+}
+
+int write_all(int fd, const void *buf, size_t len) {
+  for (size_t done = 0; done < len;) {
+    ssize_t n = write(fd, (const char *)buf + done, len - done);
+    if (n <= 0) {
+      return -1;
+    }
+    done += n;
+  }
+  return 0;
+}
+
+// Writes the table to the snapshot file @path.
+void dump_table(const Table *t, const char *path) {
+  SnapHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, SNAP_MAGIC, sizeof(SNAP_MAGIC));
+  h.version = SNAP_VERSION;
+  h.byte_order = SNAP_BYTE_ORDER;
+  h.proc_size = sizeof(Process);
+  h.nr = t->nr;
+  h.procs_off = sizeof(SnapHeader);
+  h.names_off = h.procs_off + (uint64_t)t->nr * sizeof(Process);
+  h.names_len = t->names_len;
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "error: open %s", path);
+    exit(0);
+  }
+  if (write_all(fd, &h, sizeof(h)) != 0 ||
+      write_all(fd, t->procs, (size_t)t->nr * sizeof(Process)) != 0 ||
+      write_all(fd, t->names, t->names_len) != 0) {
+    fprintf(stderr, "error: write %s", path);
+    exit(0);
+  }
+  close(fd);
+}
+
+// Maps the snapshot file @path and makes @t use its records and names in
+// place; nothing is copied, but every name offset and pid is checked. A
+// process may not be its own parent; longer cycles are left to
+// check_init().
+void load_table(Table *t, const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    fprintf(stderr, "error: open %s", path);
+    exit(0);
+  }
+  if (st.st_size < (off_t)sizeof(SnapHeader)) {
+    fprintf(stderr, "error: %s is not a pstree snapshot", path);
+    exit(0);
+  }
+  char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "error: mmap %s", path);
+    exit(0);
+  }
+
+  const SnapHeader *h = (const SnapHeader *)map;
+  uint64_t size = st.st_size;
+  if (memcmp(h->magic, SNAP_MAGIC, sizeof(h->magic)) != 0) {
+    fprintf(stderr, "error: %s is not a pstree snapshot", path);
+    exit(0);
+  }
+  if (h->version != SNAP_VERSION || h->byte_order != SNAP_BYTE_ORDER ||
+      h->proc_size != sizeof(Process)) {
+    fprintf(stderr, "error: %s: unsupported snapshot version %u", path,
+            h->version);
+    exit(0);
+  }
+  if (h->nr > INT32_MAX || h->procs_off % sizeof(uint64_t) != 0 ||
+      h->procs_off > size ||
+      (size - h->procs_off) / sizeof(Process) < h->nr ||
+      h->names_off > size || size - h->names_off < h->names_len ||
+      h->names_len > INT32_MAX ||
+      (h->names_len > 0 && map[h->names_off + h->names_len - 1] != '\0')) {
+    fprintf(stderr, "error: %s: corrupted snapshot", path);
+    exit(0);
+  }
+
+  memset(t, 0, sizeof(*t));
+  t->procs = (Process *)(map + h->procs_off);
+  t->nr = h->nr;
+  t->names = map + h->names_off;
+  t->names_len = h->names_len;
+  t->map = map;
+  t->map_len = st.st_size;
+  for (int i = 0; i < t->nr; i++) {
+    const Process *proc = &t->procs[i];
+    // an entry standing for all threads has ppid == pid (see print_label)
+    if (proc->name < 0 || proc->name >= t->names_len || proc->pid <= 0 ||
+        proc->pid == INT_MAX ||
+        (proc->threads == 0 && proc->ppid == proc->pid)) {
+      fprintf(stderr, "error: %s: corrupted snapshot", path);
+      exit(0);
+    }
+  }
+}
+
+int get_pid_max() {
+  int max = 0;
+  FILE *fp = fopen("/proc/sys/kernel/pid_max", "r");
+  if (fp) {
+    if (fscanf(fp, "%d", &max) != 1) {
+      max = 0;
+    }
+    fclose(fp);
   }
+  // PID_MAX_LIMIT on 64-bit Linux
+  return max > 0 ? max : 4194304;
+}
+
+int find_process(const Tree *tr, int pid) {
+  if (pid <= 0 || pid >= tr->pid_max) {
+    return -1;
+  }
+  return tr->index[pid] - 1;
+}
+
+// Lays out the children of every process in the (indexed) table
+// contiguously: count them, prefix-sum the counts, and fill. Called again
+// whenever the table changes.
+void link_children(const Table *t, Tree *tr) {
+  int n = t->nr + 1;
+  tr->first_child = (int *)xrealloc(tr->first_child, n * sizeof(int));
+  tr->nr_children = (int *)xrealloc(tr->nr_children, n * sizeof(int));
+  tr->children = (int *)xrealloc(tr->children, n * sizeof(int));
+  tr->sorted = (char *)xrealloc(tr->sorted, n * sizeof(char));
+  tr->repeat = (int *)xrealloc(tr->repeat, n * sizeof(int));
+  memset(tr->nr_children, 0, n * sizeof(int));
+  memset(tr->sorted, 0, n * sizeof(char));
+  memset(tr->repeat, 0, n * sizeof(int));
+  for (int i = 0; i < t->nr; i++) {
+    int parent = find_process(tr, t->procs[i].ppid);
+    if (parent >= 0) {
+      tr->nr_children[parent]++;
+    }
+  }
+  for (int i = 0, sum = 0; i < t->nr; i++) {
+    tr->first_child[i] = sum;
+    sum += tr->nr_children[i];
+    tr->nr_children[i] = 0;
+  }
+  for (int i = 0; i < t->nr; i++) {
+    int parent = find_process(tr, t->procs[i].ppid);
+    if (parent >= 0) {
+      tr->children[tr->first_child[parent] + tr->nr_children[parent]++] = i;
+    }
+  }
+}
+
+// Indexes the table by pid and links the children. The index only needs
+// to cover the pids in the table, which may come from another host.
+void build_tree(const Table *t, Tree *tr) {
+  assert(t != NULL && tr != NULL);
+  tr->pid_max = 1;
+  for (int i = 0; i < t->nr; i++) {
+    if (t->procs[i].pid >= tr->pid_max) {
+      tr->pid_max = t->procs[i].pid + 1;
+    }
+  }
+  tr->index = (int *)xcalloc(tr->pid_max, sizeof(int));
+  for (int i = 0; i < t->nr; i++) {
+    int pid = t->procs[i].pid;
+    // threads are never parents
+    if (pid > 0 && pid < tr->pid_max && t->procs[i].threads == 0) {
+      tr->index[pid] = i + 1;
+    }
+  }
+  link_children(t, tr);
+}
+
+static const Table *cmp_table;
+
+int cmp_by_pid(const void *a, const void *b) {
+  const Process *pa = &cmp_table->procs[*(const int *)a];
+  const Process *pb = &cmp_table->procs[*(const int *)b];
+  return (pa->pid > pb->pid) - (pa->pid < pb->pid);
+}
+
+// equal names are ordered by pid, so that the order is total (thus stable)
+int cmp_by_name(const void *a, const void *b) {
+  const Process *pa = &cmp_table->procs[*(const int *)a];
+  const Process *pb = &cmp_table->procs[*(const int *)b];
+  int ret = pa->name == pb->name
+                ? 0
+                : strcmp(name_of(cmp_table, pa), name_of(cmp_table, pb));
+  return ret != 0 ? ret : cmp_by_pid(a, b);
 }
 
-void sort_by_name(Children c) {
-  ChildNode *cur = c;
-  while (cur != NULL) {
-    ChildNode *next = cur->next;
-    while (next != NULL) {
-      if (strcmp(cur->val->name, next->val->name) > 0) {
-        Process *temp = cur->val;
-        cur->val = next->val;
-        next->val = temp;
+// Children are sorted lazily when their parent is printed, so processes
+// not reachable from init are never sorted.
+void sort_children(const Table *t, Tree *tr, int p, int numeric_sort_flag) {
+  if (!tr->sorted[p] && tr->nr_children[p] > 1) {
+    cmp_table = t;
+    qsort(&tr->children[tr->first_child[p]], tr->nr_children[p], sizeof(int),
+          numeric_sort_flag ? cmp_by_pid : cmp_by_name);
+  }
+  tr->sorted[p] = 1;
+}
+
+int find_init(const Tree *tr) {
+  return find_process(tr, 1);
+}
+
+// Whether the tree below @init is finite. Every process has one parent,
+// so a cycle reachable from init runs through init itself, and walking up
+// from init comes back to it within t->nr steps. Only a corrupted
+// snapshot can have one, as init has no parent.
+int check_init(const Table *t, const Tree *tr, int init) {
+  int p = init;
+  for (int i = 0; i < t->nr; i++) {
+    p = find_process(tr, t->procs[p].ppid);
+    if (p < 0) {
+      return 1;
+    }
+    if (p == init) {
+      return 0;
+    }
+  }
+  return 1;
+}
+// Line-drawing symbols, as in psmisc's pstree
+typedef struct Symbols {
+  const char *empty_2, *branch_2, *vert_2, *last_2, *single_3, *first_3;
+} Symbols;
+
+static const Symbols ascii_symbols = {"  ", "|-", "| ", "`-", "---", "-+-"};
+static const Symbols utf8_symbols = {
+    "  ",
+    "\342\224\234\342\224\200",             // ├─
+    "\342\224\202 ",                        // │
+    "\342\224\224\342\224\200",             // └─
+    "\342\224\200\342\224\200\342\224\200", // ───
+    "\342\224\200\342\224\254\342\224\200", // ─┬─
+};
+
+typedef struct Options {
+  const Symbols *sym;
+  int show_pids;
+  int numeric_sort;
+  int compact; // merge identical sibling subtrees into n*[...]
+} Options;
+
+// While capturing, the buffer grows instead of being flushed, so that a
+// whole frame can be compared with the previous one (--watch).
+static char *out_buf;
+static int out_len, out_cap;
+static int out_capture;
+
+void out_flush() {
+  if (out_capture) {
+    return;
+  }
+  for (int done = 0; done < out_len;) {
+    int n = write(STDOUT_FILENO, out_buf + done, out_len - done);
+    if (n <= 0) {
+      // e.g. the reader of a pipe is gone: nothing more can be printed
+      exit(0);
+    }
+    done += n;
+  }
+  out_len = 0;
+}
+
+// The slow path of out_reserve(): grow the buffer, or flush it.
+void out_grow(int len) {
+  if (out_buf == NULL || out_capture) {
+    while (out_len + len > out_cap) {
+      out_cap = out_cap ? out_cap * 2 : OUT_BUFSZ;
+    }
+    out_buf = (char *)xrealloc(out_buf, out_cap);
+    return;
+  }
+  out_flush();
+}
+
+// Makes room for @len more bytes.
+static inline void out_reserve(int len) {
+  if (out_len + len > out_cap) {
+    out_grow(len);
+  }
+}
+
+static inline void out_str(const char *s, int len) {
+  out_reserve(len);
+  memcpy(out_buf + out_len, s, len);
+  out_len += len;
+}
+
+static inline void out_cstr(const char *s) {
+  out_str(s, strlen(s));
+}
+
+static inline void out_char(char c) {
+  out_reserve(1);
+  out_buf[out_len++] = c;
+}
+
+static inline void out_spaces(int n) {
+  for (int i = 0; i < n; i++) {
+    out_char(' ');
+  }
+}
+
+// Prints @val in decimal; returns the number of characters printed.
+int out_int(int val) {
+  char buf[16];
+  int len = snprintf(buf, sizeof(buf), "%d", val);
+  out_str(buf, len);
+  return len;
+}
+
+// Whether the subtrees rooted at @a and @b have the same shape and names.
+int tree_equal(const Table *t, Tree *tr, int a, int b, int numeric_sort_flag) {
+  static int *stack;
+  static int cap;
+  int top = 0;
+  if (cap < 2) {
+    cap = 1024;
+    stack = (int *)xrealloc(stack, cap * sizeof(int));
+  }
+  stack[top++] = a;
+  stack[top++] = b;
+  while (top > 0) {
+    b = stack[--top];
+    a = stack[--top];
+    int nr = tr->nr_children[a];
+    if (t->procs[a].name != t->procs[b].name || nr != tr->nr_children[b] ||
+        t->procs[a].threads != t->procs[b].threads) {
+      return 0;
+    }
+    sort_children(t, tr, a, numeric_sort_flag);
+    sort_children(t, tr, b, numeric_sort_flag);
+    while (top + 2 * nr > cap) {
+      cap *= 2;
+      stack = (int *)xrealloc(stack, cap * sizeof(int));
+    }
+    for (int i = 0; i < nr; i++) {
+      stack[top++] = tr->children[tr->first_child[a] + i];
+      stack[top++] = tr->children[tr->first_child[b] + i];
+    }
+  }
+  return 1;
+}
+
+// Sets tr->repeat for the (sorted) children of @p: a group of identical
+// subtrees is printed once, by its first member, as n*[...]; the other
+// members get 0. An entry standing for several threads is a group itself.
+// Only children with the same name can be identical, so only runs of
+// equal names are compared.
+void group_children(const Table *t, Tree *tr, int p, const Options *opts) {
+  static int *scratch;
+  static int cap;
+  int nr = tr->nr_children[p];
+  int *kids = &tr->children[tr->first_child[p]];
+  for (int i = 0; i < nr; i++) {
+    int threads = t->procs[kids[i]].threads;
+    tr->repeat[kids[i]] = threads > 1 ? threads : 1;
+  }
+  if (!opts->compact || nr < 2) {
+    return;
+  }
+
+  int *byname = kids;
+  if (opts->numeric_sort) {
+    if (nr > cap) {
+      cap = nr;
+      scratch = (int *)xrealloc(scratch, cap * sizeof(int));
+    }
+    memcpy(scratch, kids, nr * sizeof(int));
+    cmp_table = t;
+    qsort(scratch, nr, sizeof(int), cmp_by_name);
+    byname = scratch;
+  }
+  for (int lo = 0, hi; lo < nr; lo = hi) {
+    int name = t->procs[byname[lo]].name;
+    for (hi = lo + 1; hi < nr && t->procs[byname[hi]].name == name; hi++) {
+    }
+    for (int i = lo; i < hi; i++) {
+      for (int j = i + 1; tr->repeat[byname[i]] != 0 && j < hi; j++) {
+        if (tr->repeat[byname[j]] != 0 &&
+            tree_equal(t, tr, byname[i], byname[j], opts->numeric_sort)) {
+          tr->repeat[byname[i]] += tr->repeat[byname[j]];
+          tr->repeat[byname[j]] = 0;
+        }
       }
-      next = next->next;
     }
-    cur = cur->next;
   }
 }
-void sort_by_pid(Children c) {
-  ChildNode *cur = c;
-  while (cur != NULL) {
-    ChildNode *next = cur->next;
-    while (next != NULL) {
-      if (cur->val->pid > next->val->pid) {
-        Process *temp = cur->val;
-        cur->val = next->val;
-        next->val = temp;
+
+// The position of the first child of @p at or after @from that starts
+// a group, or nr_children[p] if there is none.
+static inline int next_group(const Tree *tr, int p, int from) {
+  const int *kids = &tr->children[tr->first_child[p]];
+  while (from < tr->nr_children[p] && tr->repeat[kids[from]] == 0) {
+    from++;
+  }
+  return from;
+}
+
+// Prints @p at @level, preceded by the line prefix unless @p is a @first
+// child continuing its parent's line. Leaves end the line, closing the
+// @closing enclosing n*[ groups; returns 1 if children follow instead.
+int print_label(const Table *t, const Tree *tr, const Options *opts, int p,
+                int level, int first, int last, int closing, int *width,
+                char *more) {
+  const Symbols *sym = opts->sym;
+  if (!first) {
+    for (int lvl = 0; lvl < level; lvl++) {
+      out_spaces(width[lvl] + 1);
+      if (lvl == level - 1) {
+        out_cstr(last ? sym->last_2 : sym->branch_2);
+      } else {
+        out_cstr(more[lvl + 1] ? sym->vert_2 : sym->empty_2);
       }
-      next = next->next;
     }
-    cur = cur->next;
   }
+
+  int w = 0;
+  int rep = tr->repeat[p];
+  if (rep > 1) {
+    w += out_int(rep) + 2;
+    out_str("*[", 2);
+  }
+  const char *name = name_of(t, &t->procs[p]);
+  int len = strlen(name);
+  out_str(name, len);
+  w += len;
+  // an entry standing for all threads of a process (THREADS_COUNT, e.g.
+  // from a snapshot) has no tid of its own
+  const Process *proc = &t->procs[p];
+  if (opts->show_pids && !(proc->threads > 0 && proc->pid == proc->ppid)) {
+    out_char('(');
+    w += out_int(t->procs[p].pid) + 2;
+    out_char(')');
+  }
+
+  if (tr->nr_children[p] == 0) {
+    for (int i = 0; i < closing; i++) {
+      out_char(']');
+    }
+    out_char('\n');
+    return 0;
+  }
+  width[level] = w;
+  more[level] = !last;
+  return 1;
 }
 
-Process *find_init(List l) {
-  ListNode *cur = l;
-  while (cur->next != NULL) {
-    cur = cur->next;
-    if (cur->val.ppid == 0) {
-      return &(cur->val);
+typedef struct Frame {
+  int p;
+  int level;
+  int closing; // number of enclosing n*[ groups
+  int next;    // position of the next child group to print
+  int first;   // whether no child has been printed yet
+} Frame;
+
+// Prints the tree rooted at @init with an explicit stack (the tree can be
+// as deep as there are processes) into a buffer flushed by write(2).
+void print_pstree(const Table *t, Tree *tr, int init, const Options *opts) {
+  assert(init >= 0);
+  int depth = t->nr + 1;
+  Frame *stack = (Frame *)xcalloc(depth, sizeof(Frame));
+  int *width = (int *)xcalloc(depth, sizeof(int));
+  char *more = (char *)xcalloc(depth, sizeof(char));
+  int top = 0;
+
+  tr->repeat[init] = 1;
+  if (print_label(t, tr, opts, init, 0, 1, 1, 0, width, more)) {
+    sort_children(t, tr, init, opts->numeric_sort);
+    group_children(t, tr, init, opts);
+    stack[top++] = (Frame){init, 0, 0, next_group(tr, init, 0), 1};
+  }
+  while (top > 0) {
+    Frame *f = &stack[top - 1];
+    if (f->next >= tr->nr_children[f->p]) {
+      top--;
+      continue;
+    }
+    int c = tr->children[tr->first_child[f->p] + f->next];
+    int first = f->first;
+    f->next = next_group(tr, f->p, f->next + 1);
+    f->first = 0;
+    int last = (f->next >= tr->nr_children[f->p]);
+    if (first) {
+      out_cstr(last ? opts->sym->single_3 : opts->sym->first_3);
+    }
+    int closing = f->closing + (tr->repeat[c] > 1);
+    if (print_label(t, tr, opts, c, f->level + 1, first, last, closing, width,
+                    more)) {
+      sort_children(t, tr, c, opts->numeric_sort);
+      group_children(t, tr, c, opts);
+      stack[top++] = (Frame){c, f->level + 1, closing, next_group(tr, c, 0), 1};
     }
   }
-  return NULL;
+  out_flush();
+
+  free(stack);
+  free(width);
+  free(more);
 }
-void print_pstree_helper(Process *p, int show_pids_flag, int depth) {
-  assert(p != NULL);
-  for (int i = 0; i < depth; i++) {
-    printf("|   ");
+
+// --watch keeps the table, the pid index and the frame on the screen
+// resident. A refresh lists /proc and re-reads the stat of a pid only if
+// its directory is new or has another inode number: procfs gives every
+// new process a fresh one, so a reused pid always shows up, and its
+// starttime tells it from the same process under a re-created inode. The
+// children of vanished processes are re-read too, as they have been
+// reparented. A process is read again in the refresh after it appears,
+// since a fork(2) is usually followed by exec(2), which renames it without
+// a new inode; other renames wait for a full rescan every WATCH_RESCAN
+// refreshes. Threads have no cheap test and are re-enumerated.
+typedef struct Watch {
+  uint64_t *ino;  // inode number of /proc/<pid>, parallel to the table
+  unsigned *seen; // the last refresh that listed the pid
+  int cap;
+  unsigned gen;
+  char *dents;
+  char *frame; // what is on the screen, as lines
+  int frame_len;
+  int rows, cols;
+} Watch;
+
+void watch_reserve(Watch *w, int n) {
+  if (n > w->cap) {
+    while (n > w->cap) {
+      w->cap = w->cap ? w->cap * 2 : 1024;
+    }
+    w->ino = (uint64_t *)xrealloc(w->ino, w->cap * sizeof(uint64_t));
+    w->seen = (unsigned *)xrealloc(w->seen, w->cap * sizeof(unsigned));
+  }
+}
+
+// Removes procs[@i] by moving the last entry into its place.
+void watch_remove(Table *t, Tree *tr, Watch *w, int i) {
+  const Process *p = &t->procs[i];
+  if (p->threads == 0 && find_process(tr, p->pid) == i) {
+    tr->index[p->pid] = 0;
+  }
+  int last = --t->nr;
+  if (i != last) {
+    t->procs[i] = t->procs[last];
+    w->ino[i] = w->ino[last];
+    w->seen[i] = w->seen[last];
+    p = &t->procs[i];
+    if (p->threads == 0 && find_process(tr, p->pid) == last) {
+      tr->index[p->pid] = i + 1;
+    }
+  }
+}
+
+// Re-reads the parent of each child of procs[@i], which is gone.
+void reparent_children(Table *t, const Tree *tr, int procfd, int i) {
+  char buf[STAT_BUFSZ];
+  Stat st;
+  for (int j = 0; j < tr->nr_children[i]; j++) {
+    Process *c = &t->procs[tr->children[tr->first_child[i] + j]];
+    if (c->threads == 0 && read_stat(procfd, c->pid, buf, &st) == 0 &&
+        st.starttime == c->starttime) {
+      c->ppid = st.ppid;
+    }
+  }
+}
+
+// Brings the table, the pid index and the children up to date; returns
+// whether anything changed.
+int watch_refresh(Table *t, Tree *tr, Watch *w, int procfd, int mode) {
+  int *pids;
+  uint64_t *inos;
+  lseek(procfd, 0, SEEK_SET);
+  int nr_pids = list_pids(procfd, &pids, &inos);
+  int old_nr = t->nr;
+  int changed = 0;
+  char buf[STAT_BUFSZ];
+  Stat st;
+
+  w->gen++;
+  int rescan = (w->gen % WATCH_RESCAN == 0);
+  watch_reserve(w, t->nr);
+  for (int k = 0; k < nr_pids; k++) {
+    if (pids[k] >= tr->pid_max) {
+      continue;
+    }
+    int i = find_process(tr, pids[k]);
+    if (i >= 0 && w->ino[i] == inos[k] && !rescan) {
+      w->seen[i] = w->gen;
+      continue;
+    }
+    if (read_stat(procfd, pids[k], buf, &st) != 0 || st.pid != pids[k]) {
+      continue;
+    }
+    if (i < 0) {
+      add_process(t, st.pid, st.ppid, st.name, st.len);
+      i = t->nr - 1;
+      tr->index[st.pid] = i + 1;
+      watch_reserve(w, t->nr);
+      changed = 1;
+    } else {
+      Process *p = &t->procs[i];
+      int name = intern_name(t, st.name, st.len);
+      if (p->starttime != st.starttime) {
+        // the pid has been reused
+        reparent_children(t, tr, procfd, i);
+      }
+      if (p->ppid != st.ppid || p->name != name ||
+          p->starttime != st.starttime) {
+        p->ppid = st.ppid;
+        p->name = name;
+        changed = 1;
+      }
+    }
+    t->procs[i].starttime = st.starttime;
+    // no inode is 0: a new process is read once more in the next refresh
+    w->ino[i] = (i >= old_nr ? 0 : inos[k]);
+    w->seen[i] = w->gen;
+  }
+
+  // the children are still linked as of the last change
+  for (int i = 0; i < old_nr; i++) {
+    if (t->procs[i].threads == 0 && w->seen[i] != w->gen) {
+      reparent_children(t, tr, procfd, i);
+      changed = 1;
+    }
+  }
+  for (int i = t->nr - 1; i >= 0; i--) {
+    int threads = t->procs[i].threads;
+    if (threads != 0 ? mode != THREADS_NONE : w->seen[i] != w->gen) {
+      watch_remove(t, tr, w, i);
+    }
+  }
+
+  if (mode != THREADS_NONE) {
+    for (int i = 0, nr = t->nr; i < nr; i++) {
+      // adding threads may move the arena
+      char name[NAME_MAX];
+      int len = strlen(name_of(t, &t->procs[i]));
+      memcpy(name, name_of(t, &t->procs[i]), len);
+      read_threads(t, procfd, t->procs[i].pid, name, len, mode, w->dents);
+    }
+    watch_reserve(w, t->nr);
+    changed = 1;
+  }
+
+  if (changed) {
+    link_children(t, tr);
+  }
+  free(pids);
+  free(inos);
+  return changed;
+}
+
+// Splits the line at *@pos off a buffer ending at @end; returns its
+// length without the newline.
+static int next_line(const char **pos, const char *end, const char **line) {
+  *line = *pos;
+  const char *nl = *pos < end ? memchr(*pos, '\n', end - *pos) : NULL;
+  int len = (nl ? nl : end) - *pos;
+  *pos = nl ? nl + 1 : end;
+  return len;
+}
+
+// The length of the longest prefix of @line that fits in @cols columns.
+int fit_line(const char *line, int len, int cols) {
+  int n = 0;
+  for (int col = 0; n < len; n++) {
+    // UTF-8 continuation bytes take no column
+    if (((unsigned char)line[n] & 0xc0) != 0x80 && col++ == cols) {
+      break;
+    }
   }
-  if (depth > 0) {
-    printf("+-- ");
+  return n;
+}
+
+// Shows @frame, rewriting only the screen lines that differ from the
+// previous frame, which @frame replaces.
+void watch_redraw(Watch *w, char *frame, int len) {
+  const char *cur = frame, *end = frame + len;
+  const char *old = w->frame, *old_end = w->frame + w->frame_len;
+  if (w->frame == NULL) {
+    out_cstr("\033[H\033[2J");
+    old = old_end = NULL;
   }
-  printf("%s", p->name);
-  if (show_pids_flag) {
-    printf("(%d)", p->pid);
+  for (int row = 1; row <= w->rows && (cur < end || old < old_end); row++) {
+    const char *line, *old_line;
+    int n = next_line(&cur, end, &line);
+    int o = next_line(&old, old_end, &old_line);
+    n = fit_line(line, n, w->cols);
+    o = fit_line(old_line, o, w->cols);
+    if (n != o || memcmp(line, old_line, n) != 0) {
+      char pos[32];
+      snprintf(pos, sizeof(pos), "\033[%d;1H", row);
+      out_cstr(pos);
+      out_str(line, n);
+      out_cstr("\033[K");
+    }
   }
-  printf("\n");
-  Children children = p->children;
-  while (children != NULL) {
-    print_pstree_helper(children->val, show_pids_flag, depth + 1);
-    children = children->next;
+  out_flush();
+  free(w->frame);
+  w->frame = frame;
+  w->frame_len = len;
+}
+
+// Renders the tree into a new frame (owned by the caller).
+char *render_frame(const Table *t, Tree *tr, const Options *opts, int *len) {
+  int init = find_init(tr);
+  out_capture = 1;
+  out_reserve(1);
+  if (init >= 0) {
+    print_pstree(t, tr, init, opts);
   }
+  char *frame = out_buf;
+  *len = out_len;
+  out_buf = NULL;
+  out_len = out_cap = 0;
+  out_capture = 0;
+  return frame;
 }
 
-void print_pstree(Process *init, int show_pids_flag) {
-  assert(init != NULL);
-  printf("%s", init->name);
-  if (show_pids_flag) {
-    printf("(%d)", init->pid);
+// Refreshes the tree every @interval seconds until killed.
+void watch(const Options *opts, int mode, double interval) {
+  Table t = {0};
+  Tree tr = {0};
+  Watch w = {0};
+  int procfd = open(PROC_ROOT, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (procfd < 0) {
+    fprintf(stderr, "error: open dir " PROC_ROOT);
+    exit(0);
   }
-  printf("\n");
-  Children children = init->children;
-  while (children != NULL) {
-    print_pstree_helper(children->val, show_pids_flag, 1);
-    children = children->next;
+  tr.pid_max = get_pid_max();
+  tr.index = (int *)xcalloc(tr.pid_max, sizeof(int));
+  w.dents = (char *)xrealloc(NULL, DENTS_BUFSZ);
+  struct timespec ts = {(time_t)interval,
+                        (long)((interval - (time_t)interval) * 1e9)};
+
+  while (1) {
+    int changed = watch_refresh(&t, &tr, &w, procfd, mode);
+    struct winsize ws;
+    int rows = 24, cols = 80;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0) {
+      rows = ws.ws_row;
+      cols = ws.ws_col;
+    }
+    if (rows != w.rows || cols != w.cols) {
+      // start over on a cleared screen
+      free(w.frame);
+      w.frame = NULL;
+      w.frame_len = 0;
+      w.rows = rows;
+      w.cols = cols;
+      changed = 1;
+    }
+    if (changed) {
+      int len;
+      char *frame = render_frame(&t, &tr, opts, &len);
+      watch_redraw(&w, frame, len);
+    }
+    nanosleep(&ts, NULL);
   }
 }
 
 int main(int argc, char *argv[]) {
   struct option opts[] = {{"show-pids", 0, NULL, 'p'},
                           {"numeric-sort", 0, NULL, 'n'},
-                          {"version", 0, NULL, 'V'}};
+                          {"version", 0, NULL, 'V'},
+                          {"ascii", 0, NULL, 'A'},
+                          {"unicode", 0, NULL, 'U'},
+                          {"compact-not", 0, NULL, 'c'},
+                          {"threads", 0, NULL, 't'},
+                          {"thread-names", 0, NULL, 'N'},
+                          {"jobs", 1, NULL, 'j'},
+                          {"watch", 1, NULL, 'w'},
+                          {"dump", 1, NULL, 'D'},
+                          {"load", 1, NULL, 'L'},
+                          {0, 0, NULL, 0}};
   char c;
-  int show_pids_flag = 0;
-  int numeric_sort_flag = 0;
-  while ((c = getopt_long(argc, argv, "pnV", opts, NULL)) != EOF) {
+  int nr_threads = 1;
+  int thread_mode = THREADS_NONE;
+  double watch_interval = 0;
+  const char *dump_path = NULL;
+  const char *load_path = NULL;
+  Options options = {.sym = &ascii_symbols, .compact = 1};
+  setlocale(LC_CTYPE, "");
+  if (strcmp(nl_langinfo(CODESET), "UTF-8") == 0) {
+    options.sym = &utf8_symbols;
+  }
+  while ((c = getopt_long(argc, argv, "pnAUctVj:w:", opts, NULL)) != EOF) {
     switch (c) {
     case 'p':
-      show_pids_flag = 1;
+      // pids make every subtree distinct
+      options.show_pids = 1;
+      options.compact = 0;
       break;
     case 'n':
-      numeric_sort_flag = 1;
+      options.numeric_sort = 1;
+      break;
+    case 'A':
+      options.sym = &ascii_symbols;
+      break;
+    case 'U':
+      options.sym = &utf8_symbols;
+      break;
+    case 'c':
+      options.compact = 0;
+      break;
+    case 't':
+      if (thread_mode == THREADS_NONE) {
+        thread_mode = THREADS_COUNT;
+      }
+      break;
+    case 'N':
+      thread_mode = THREADS_NAMED;
       break;
     case 'V':
       fprintf(stderr, "pstree 0.0.1\n");
       return 0;
+    case 'j':
+      nr_threads = atoi(optarg);
+      if (nr_threads < 1 || nr_threads > MAX_THREADS) {
+        fprintf(stderr, "error: -j takes 1 to %d threads", MAX_THREADS);
+        exit(0);
+      }
+      break;
+    case 'w':
+      watch_interval = atof(optarg);
+      if (!(watch_interval > 0)) {
+        fprintf(stderr, "error: --watch takes an interval in seconds");
+        exit(0);
+      }
+      break;
+    case 'D':
+      dump_path = optarg;
+      break;
+    case 'L':
+      load_path = optarg;
+      break;
     }
   }
 
-  ListNode head;
-  head.next = NULL;
-  List l = &head;
+  Table table = {0};
+  Tree tree = {0};
 
-  get_processes(l);
-  Process *init = find_init(l);
-  if (!init) {
+  if (thread_mode == THREADS_COUNT && !options.compact) {
+    // every thread is printed on its own line
+    thread_mode = THREADS_EACH;
+  }
+  if (watch_interval > 0) {
+    if (dump_path != NULL || load_path != NULL) {
+      fprintf(stderr, "error: --watch reads the live " PROC_ROOT);
+      exit(0);
+    }
+    watch(&options, thread_mode, watch_interval);
+  }
+  if (load_path != NULL) {
+    load_table(&table, load_path);
+  } else {
+    get_processes(&table, nr_threads, thread_mode);
+  }
+  if (dump_path != NULL) {
+    dump_table(&table, dump_path);
+    free_table(&table);
+    return 0;
+  }
+  build_tree(&table, &tree);
+  int init = find_init(&tree);
+  if (init < 0) {
     fprintf(stderr, "error: no find init");
     exit(0);
   }
-  set_children(l);
-  sort(l, numeric_sort_flag);
-  print_pstree(init, show_pids_flag);
+  if (!check_init(&table, &tree, init)) {
+    fprintf(stderr, "error: init is its own ancestor");
+    exit(0);
+  }
+  print_pstree(&table, &tree, init, &options);
 
-  free_list(l);
+  free_tree(&tree);
+  free_table(&table);
 
   return 0;
-}
\ No newline at end of file
+}